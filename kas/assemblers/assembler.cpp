@@ -20,6 +20,8 @@
 * SOFTWARE.
 */
 
+#include <algorithm>
+#include <stdexcept>
 #include "assemblers/assembler.hpp"
 #include "diagnostic/log.hpp"
 
@@ -35,10 +37,24 @@ kdk::assembler::assembler(const kdk::resource& resource)
 
 rsrc::data kdk::assembler::assemble()
 {
-    return m_blob;
+    return std::move(m_blob);
 }
 
-void kdk::assembler::assemble(kdk::assembler::field field)
+void kdk::assembler::assemble(const std::vector<kdk::assembler::field>& layout)
+{
+    // Size the data up front, so that it is not reallocated as each field is added.
+    uint64_t size = 0;
+    for (const auto& field : layout) {
+        size = std::max(size, field.required_data_size());
+    }
+    m_blob.reserve(size);
+    
+    for (const auto& field : layout) {
+        assemble(field);
+    }
+}
+
+void kdk::assembler::assemble(const kdk::assembler::field& field)
 {
     // Find the field with in the resource
     auto resource_field = find_field(field.name(), field.is_required());
@@ -50,7 +66,7 @@ void kdk::assembler::assemble(kdk::assembler::field field)
     
     // Is the field deprecated? If show show a warning.
     if (field.is_deprecated()) {
-        log::warning("<missing>", 0, "The field '" + field.name() + "' is deprecated.");
+        log::warning("<missing>", 0, "The field '" + field.name().str() + "' is deprecated.");
     }
     
     // If the field was provided in the script, then handle it, otherwise try to fill it in with
@@ -58,56 +74,68 @@ void kdk::assembler::assemble(kdk::assembler::field field)
     if (resource_field) {
         // Check the number of values matches what we actually have.
         if (resource_field->values().size() != field.expected_values().size()) {
-            log::error("<missing>", 0, "Incorrect number of values passed to field '" + field.name() + "'.");
+            log::error("<missing>", 0, "Incorrect number of values passed to field '" + field.name().str() + "'.");
         }
         
         // Prepare to encode and validate each of the values.
         for (auto n = 0; n < field.expected_values().size(); ++n) {
-            auto value = resource_field->values()[n];
-            auto expected_value = field.expected_values()[n];
+            const auto& value = resource_field->values()[n];
+            const auto& expected_value = field.expected_values()[n];
             
-            if (!expected_value.type_allowed(std::get<1>(value))) {
+            if (!expected_value.type_allowed(value.type())) {
                 // The value type is incorrect
-                log::error("<missing>", 0, "Incorrect value type provided on field '" + field.name() + "' value " + std::to_string(n) + ".");
+                log::error("<missing>", 0, "Incorrect value type provided on field '" + field.name().str() + "' value " + std::to_string(n) + ".");
             }
             
             // Seek to the appropriate location in the data for encoding.
             m_blob.set_insertion_point(expected_value.offset());
             
             // Handle the value appropriately and encode it into the data.
-            switch (std::get<1>(value)) {
+            switch (value.type()) {
                 case kdk::resource::field::value_type::integer:
                 case kdk::resource::field::value_type::percentage: {
-                    encode(std::get<0>(value), expected_value.size());
+                    encode(value.number(), expected_value.size());
                     break;
                 }
                     
                 case kdk::resource::field::value_type::resource_id: {
-                    m_blob.write_signed_word(static_cast<int16_t>(std::stoi(std::get<0>(value))));
+                    // Record the reference so that it can be checked once every resource is known.
+                    if (!expected_value.reference_type().empty()) {
+                        m_references.push_back({
+                            expected_value.reference_type(), value.number(), field.name(),
+                            resource_field->source_file(), resource_field->source_offset()
+                        });
+                    }
+                    m_blob.write_signed_word(static_cast<int16_t>(value.number()));
                     break;
                 }
                     
                 case kdk::resource::field::value_type::string: {
                     if (expected_value.type_mask() & kdk::assembler::field::value::type::p_string) {
                         // C String
-                        m_blob.write_cstr(std::get<0>(value), expected_value.size());
+                        m_blob.write_cstr(std::string(value.text()), expected_value.size());
                     }
                     else {
                         // Pascal String
-                        m_blob.write_pstr(std::get<0>(value));
+                        m_blob.write_pstr(std::string(value.text()));
                     }
                     break;
                 }
                     
                 case kdk::resource::field::value_type::identifier: {
-                    for (auto symbol : expected_value.symbols()) {
-                        if (std::get<0>(value) == std::get<0>(symbol)) {
-                            encode(std::get<0>(value), expected_value.size());
+                    // Substitute the symbol for the value it represents.
+                    auto found = false;
+                    for (const auto& symbol : expected_value.symbols()) {
+                        if (value.atom() == std::get<0>(symbol)) {
+                            encode(std::get<1>(symbol), expected_value.size());
+                            found = true;
                             break;
                         }
                     }
                     
-                    log::error("<missing>", 0, "The symbol '" + std::get<0>(value) + "' was not recognised.");
+                    if (!found) {
+                        log::error("<missing>", 0, "The symbol '" + std::string(value.text()) + "' was not recognised.");
+                    }
                     break;
                 }
                     
@@ -117,8 +145,12 @@ void kdk::assembler::assemble(kdk::assembler::field field)
                 }
                     
                 case kdk::resource::field::value_type::color: {
-                    auto rgb = static_cast<uint32_t>(std::stoi(std::get<0>(value)));
-                    m_blob.write_long(rgb);
+                    m_blob.write_long(value.color());
+                    break;
+                }
+                    
+                case kdk::resource::field::value_type::expression: {
+                    // Expressions are folded before the target is built.
                     break;
                 }
             }
@@ -126,38 +158,38 @@ void kdk::assembler::assemble(kdk::assembler::field field)
     }
     else {
         // No field was specified in the resource, so write the default values.
-        for (auto expected : field.expected_values()) {
+        for (const auto& expected : field.expected_values()) {
             expected.write_default_value(m_blob);
         }
     }
     
 }
 
-void kdk::assembler::encode(const std::string value, uint64_t width, bool is_signed)
+void kdk::assembler::encode(const int64_t value, uint64_t width, bool is_signed)
 {
     if (width == 1 && is_signed) {
-        m_blob.write_signed_byte(static_cast<int8_t>(std::stol(value)));
+        m_blob.write_signed_byte(static_cast<int8_t>(value));
     }
     else if (width == 1) {
-        m_blob.write_byte(static_cast<uint8_t>(std::stoul(value)));
+        m_blob.write_byte(static_cast<uint8_t>(value));
     }
     else if (width == 2 && is_signed) {
-        m_blob.write_signed_word(static_cast<int16_t>(std::stol(value)));
+        m_blob.write_signed_word(static_cast<int16_t>(value));
     }
     else if (width == 2) {
-        m_blob.write_word(static_cast<uint16_t>(std::stoul(value)));
+        m_blob.write_word(static_cast<uint16_t>(value));
     }
     else if (width == 4 && is_signed) {
-        m_blob.write_signed_long(static_cast<int32_t>(std::stol(value)));
+        m_blob.write_signed_long(static_cast<int32_t>(value));
     }
     else if (width == 4) {
-        m_blob.write_long(static_cast<uint32_t>(std::stoul(value)));
+        m_blob.write_long(static_cast<uint32_t>(value));
     }
     else if (width == 8 && is_signed) {
-        m_blob.write_signed_quad(static_cast<int64_t>(std::stoll(value)));
+        m_blob.write_signed_quad(static_cast<int64_t>(value));
     }
     else if (width == 8) {
-        m_blob.write_quad(static_cast<uint64_t>(std::stoull(value)));
+        m_blob.write_quad(static_cast<uint64_t>(value));
     }
     else {
         throw std::runtime_error("Illegal integer width");
@@ -167,7 +199,7 @@ void kdk::assembler::encode(const std::string value, uint64_t width, bool is_sig
 // MARK: - Fields
 
 kdk::assembler::field::field(const std::string& name)
-    : m_name(name)
+    : m_name(kdk::atom(name))
 {
     
 }
@@ -198,7 +230,7 @@ kdk::assembler::field kdk::assembler::field::set_values(const std::vector<kdk::a
 uint64_t kdk::assembler::field::size() const
 {
     uint64_t size = 0;
-    for (auto v : m_expected_values) {
+    for (const auto& v : m_expected_values) {
         size += v.size();
     }
     return size;
@@ -207,7 +239,7 @@ uint64_t kdk::assembler::field::size() const
 uint64_t kdk::assembler::field::required_data_size() const
 {
     uint64_t minimum_size = 0;
-    for (auto v : m_expected_values) {
+    for (const auto& v : m_expected_values) {
         uint64_t size = v.offset() + v.size();
         minimum_size = std::max(minimum_size, size);
     }
@@ -229,7 +261,7 @@ bool kdk::assembler::field::is_deprecated() const
     return m_deprecated;
 }
 
-std::string& kdk::assembler::field::name()
+kdk::atom kdk::assembler::field::name() const
 {
     return m_name;
 }
@@ -239,6 +271,11 @@ std::vector<kdk::assembler::field::value>& kdk::assembler::field::expected_value
     return m_expected_values;
 }
 
+const std::vector<kdk::assembler::field::value>& kdk::assembler::field::expected_values() const
+{
+    return m_expected_values;
+}
+
 // MARK: - Values
 
 kdk::assembler::field::value::value(std::string name, kdk::assembler::field::value::type type, uint64_t offset, uint64_t size)
@@ -254,7 +291,10 @@ kdk::assembler::field::value kdk::assembler::field::value::expect(const std::str
 
 kdk::assembler::field::value kdk::assembler::field::value::set_symbols(const std::vector<std::tuple<std::string, int64_t>> symbols)
 {
-    m_symbols = symbols;
+    m_symbols.clear();
+    for (const auto& symbol : symbols) {
+        m_symbols.emplace_back(kdk::atom(std::get<0>(symbol)), std::get<1>(symbol));
+    }
     return *this;
 }
 
@@ -274,11 +314,27 @@ uint64_t kdk::assembler::field::value::offset() const
     return m_offset;
 }
 
-std::vector<std::tuple<std::string, int64_t>>& kdk::assembler::field::value::symbols()
+std::vector<std::tuple<kdk::atom, int64_t>>& kdk::assembler::field::value::symbols()
 {
     return m_symbols;
 }
 
+const std::vector<std::tuple<kdk::atom, int64_t>>& kdk::assembler::field::value::symbols() const
+{
+    return m_symbols;
+}
+
+kdk::assembler::field::value kdk::assembler::field::value::set_reference_type(const std::string type)
+{
+    m_reference_type = kdk::atom(type);
+    return *this;
+}
+
+kdk::atom kdk::assembler::field::value::reference_type() const
+{
+    return m_reference_type;
+}
+
 bool kdk::assembler::field::value::type_allowed(kdk::resource::field::value_type type) const
 {
     switch (type) {
@@ -304,6 +360,9 @@ bool kdk::assembler::field::value::type_allowed(kdk::resource::field::value_type
         case kdk::resource::field::value_type::color: {
             return m_type_mask & kdk::assembler::field::value::type::color;
         }
+        case kdk::resource::field::value_type::expression: {
+            return false;
+        }
     }
 }
                         
@@ -322,11 +381,19 @@ void kdk::assembler::field::value::write_default_value(rsrc::data& data) const
 
 // MARK: - Field Functions
 
-std::shared_ptr<kdk::resource::field> kdk::assembler::find_field(std::string& name, bool required) const
+const kdk::resource::field *kdk::assembler::find_field(kdk::atom name, bool required) const
 {
-    auto field = m_resource.field_named(name);
-    if (required && !field) {
-        log::error("<missing>", 0, "Missing field '" + name + "' in resource.");
+    auto fields = m_resource.fields_named(name);
+    if (required && fields.empty()) {
+        log::error("<missing>", 0, "Missing field '" + name.str() + "' in resource.");
     }
-    return field;
+    if (fields.size() > 1) {
+        log::error(fields[1].source_file(), fields[1].source_offset(), "The field '" + name.str() + "' may only be given once.");
+    }
+    return fields.empty() ? nullptr : fields.data();
+}
+
+const std::vector<kdk::assembler::reference>& kdk::assembler::references() const
+{
+    return m_references;
 }
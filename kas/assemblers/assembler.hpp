@@ -23,6 +23,7 @@
 #include <type_traits>
 #include <memory>
 #include <tuple>
+#include <functional>
 #include "rsrc/data.hpp"
 #include "structures/resource.hpp"
 
@@ -98,6 +99,13 @@ public:
              */
             kdk::assembler::field::value set_default_value(const std::function<void(rsrc::data&)> default_value);
             
+            /**
+             * Specify the type of resource that a resource reference value refers to. Only
+             * references to a known type of resource can be checked for existence, so
+             * references without a type are left unchecked.
+             */
+            kdk::assembler::field::value set_reference_type(const std::string type);
+            
             /**
              * Returns the size of the value when encoded
              */
@@ -126,15 +134,26 @@ public:
             /**
              * Returns a vector of symbol tuples for the value.
              */
-            std::vector<std::tuple<std::string, int64_t>>& symbols();
+            std::vector<std::tuple<kdk::atom, int64_t>>& symbols();
+            
+            /**
+             * Returns a vector of symbol tuples for the value.
+             */
+            const std::vector<std::tuple<kdk::atom, int64_t>>& symbols() const;
+            
+            /**
+             * Returns the type of resource that the value refers to, if any.
+             */
+            kdk::atom reference_type() const;
             
         private:
             std::string m_name;
             kdk::assembler::field::value::type m_type_mask;
-            std::vector<std::tuple<std::string, int64_t>> m_symbols;
+            std::vector<std::tuple<kdk::atom, int64_t>> m_symbols;
             uint64_t m_size;
             uint64_t m_offset;
             std::function<void(rsrc::data&)> m_default_value;
+            kdk::atom m_reference_type;
         };
         
     public:
@@ -193,54 +212,88 @@ public:
         /**
          * Returns the name of the field.
          */
-        std::string& name();
+        kdk::atom name() const;
         
         /**
          * Returns the expected values vector.
          */
         std::vector<kdk::assembler::field::value>& expected_values();
         
+        /**
+         * Returns the expected values vector.
+         */
+        const std::vector<kdk::assembler::field::value>& expected_values() const;
+        
     private:
         bool m_required { false };
         bool m_deprecated { false };
-        std::string m_name;
+        kdk::atom m_name;
         std::vector<kdk::assembler::field::value> m_expected_values;
     };
     
+    /**
+     * A reference from the resource being assembled to another resource, along with the
+     * location in the source at which it was made.
+     */
+    struct reference
+    {
+        kdk::atom type;
+        int64_t id;
+        kdk::atom field;
+        kdl::source_manager::file_id file;
+        uint32_t offset;
+    };
+    
 public:
     /**
      * Construct a new assembler using the specified resource. This assembler
      * does not specifically care about type (this information should be provided
-     * by the subclass.)
+     * by the subclass.) The resource is not copied, and must outlive the assembler.
      */
     assembler(const kdk::resource& resource);
     
     /**
      * Performs assembly of the resource.
      *
-     * This method should be implemented by the subclass.
+     * This method should be implemented by the subclass. The assembled data is moved
+     * out of the assembler, so it can only be taken once.
      */
     rsrc::data assemble();
     
     /**
      * Assemble the specified field.
      */
-    void assemble(const kdk::assembler::field field);
+    void assemble(const kdk::assembler::field& field);
+    
+    /**
+     * Assemble each of the fields of a layout in turn. The layout of a resource type is
+     * the same for every resource, so subclasses build it once and reuse it.
+     */
+    void assemble(const std::vector<kdk::assembler::field>& layout);
+    
+    /**
+     * Find the specified field in the source resource. The field is owned by the resource,
+     * and is not copied. A field that is given more than once is reported as an error, as
+     * only the first occurrence could be assembled.
+     */
+    const kdk::resource::field *find_field(kdk::atom name, bool required = false) const;
     
     /**
-     * Find the specified field in the source resource.
+     * Returns the references to other resources of a known type that were encountered
+     * whilst assembling the resource.
      */
-    std::shared_ptr<kdk::resource::field> find_field(std::string& name, bool required = false) const;
+    const std::vector<kdk::assembler::reference>& references() const;
     
 private:
-    kdk::resource m_resource;
+    const kdk::resource& m_resource;
     rsrc::data m_blob;
+    std::vector<kdk::assembler::reference> m_references;
     
     /**
      * Write the specified value as an integer to the data at the current
      * offset.
      */
-    void encode(const std::string value, uint64_t width, bool is_signed = true);
+    void encode(const int64_t value, uint64_t width, bool is_signed = true);
 };
 
 };
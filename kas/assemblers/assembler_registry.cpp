@@ -0,0 +1,49 @@
+/*
+* Copyright (c) 2019 Tom Hancocks
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <stdexcept>
+#include "assemblers/assembler_registry.hpp"
+
+// MARK: - Registry
+
+kdk::assembler_registry& kdk::assembler_registry::shared()
+{
+    // Registrations happen during static initialisation, so the registry needs to be
+    // constructed on first use rather than as a global of its own.
+    static kdk::assembler_registry registry;
+    return registry;
+}
+
+void kdk::assembler_registry::add(const std::string& type, const std::string& type_code, kdk::assembler_registry::assemble_function assemble)
+{
+    kdk::atom name { type };
+    if (!m_types.emplace(name, m_entries.size()).second) {
+        throw std::runtime_error("An assembler has already been registered for the type '" + type + "'.");
+    }
+    m_entries.push_back({ name, type_code, std::move(assemble) });
+}
+
+const kdk::assembler_registry::entry *kdk::assembler_registry::find(kdk::atom type) const
+{
+    auto it = m_types.find(type);
+    return (it == m_types.end()) ? nullptr : &m_entries[it->second];
+}
@@ -0,0 +1,104 @@
+/*
+* Copyright (c) 2019 Tom Hancocks
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "assemblers/assembler.hpp"
+
+#if !defined(KDK_ASSEMBLER_REGISTRY)
+#define KDK_ASSEMBLER_REGISTRY
+
+namespace kdk
+{
+
+/**
+ * The kdk::assembler_registry class maps each resource type that can be assembled to
+ * the assembler for it, and to the four character code that the assembled resources are
+ * written with. Assemblers register themselves when the program starts, through a static
+ * kdk::assembler_registry::registration, so adding a type does not require changes
+ * anywhere else.
+ */
+class assembler_registry
+{
+public:
+    
+    /**
+     * A function that assembles a single resource, and reports the references that it makes
+     * to other resources.
+     */
+    typedef std::function<rsrc::data(const kdk::resource&, std::vector<kdk::assembler::reference>&)> assemble_function;
+    
+    /**
+     * A resource type that can be assembled.
+     */
+    struct entry
+    {
+        kdk::atom type;
+        std::string type_code;
+        kdk::assembler_registry::assemble_function assemble;
+    };
+    
+    /**
+     * Registers the assembler T for a resource type. Instances of this are intended to be
+     * declared as statics alongside the assembler that they register.
+     */
+    template<class T>
+    struct registration
+    {
+        registration(const std::string& type, const std::string& type_code)
+        {
+            kdk::assembler_registry::shared().add(type, type_code, [] (const kdk::resource& resource, std::vector<kdk::assembler::reference>& references) {
+                T assembler { resource };
+                auto data = assembler.assemble();
+                references = assembler.references();
+                return data;
+            });
+        }
+    };
+    
+public:
+    /**
+     * Returns the registry for the process.
+     */
+    static kdk::assembler_registry& shared();
+    
+    /**
+     * Register an assembler for the specified type. Each type may only be registered once.
+     */
+    void add(const std::string& type, const std::string& type_code, kdk::assembler_registry::assemble_function assemble);
+    
+    /**
+     * Find the entry for the specified type, or nullptr if there is no assembler for it.
+     */
+    const kdk::assembler_registry::entry *find(kdk::atom type) const;
+    
+private:
+    std::deque<kdk::assembler_registry::entry> m_entries;
+    std::unordered_map<kdk::atom, std::size_t> m_types;
+};
+
+};
+
+#endif
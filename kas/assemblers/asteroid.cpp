@@ -21,19 +21,26 @@
 */
 
 #include "assemblers/asteroid.hpp"
+#include "assemblers/assembler_registry.hpp"
+
+// MARK: - Registration
+
+namespace
+{
+
+const kdk::assembler_registry::registration<kdk::asteroid> registration { "Asteroid", "röid" };
+
+};
 
 // MARK: - Assembly
 
 rsrc::data kdk::asteroid::assemble()
 {
-    // Handle each of the fields in the resource.
-    assembler::assemble(
+    // The layout is the same for every resource of the type, so it is only built once.
+    static const std::vector<kdk::assembler::field> layout {
         kdk::assembler::field::named("strength").set_required(true).set_values({
             kdk::assembler::field::value::expect("value", kdk::assembler::field::value::type::integer, 0, 2),
-        })
-    );
-    
-    assembler::assemble(
+        }),
         kdk::assembler::field::named("spin_rate").set_values({
             kdk::assembler::field::value::expect("value", kdk::assembler::field::value::type::integer, 2, 2)
                 .set_symbols({
@@ -46,10 +53,7 @@ rsrc::data kdk::asteroid::assemble()
                 .set_default_value([] (rsrc::data& data) {
                     data.write_signed_word(50);
                 }),
-        })
-    );
-    
-    assembler::assemble(
+        }),
         kdk::assembler::field::named("yield").set_required(true).set_values({
             kdk::assembler::field::value::expect("type", kdk::assembler::field::value::type::resource_reference, 4, 2)
                 .set_symbols({
@@ -61,11 +65,8 @@ rsrc::data kdk::asteroid::assemble()
                     std::make_tuple("equipment", 5),
                 }),
             kdk::assembler::field::value::expect("quantity", kdk::assembler::field::value::type::integer, 6, 2)
-        })
-    );
-    
-    assembler::assemble(
-		kdk::assembler::field::named("particles").set_required(false).set_values({
+        }),
+        kdk::assembler::field::named("particles").set_required(false).set_values({
             kdk::assembler::field::value::expect("count", kdk::assembler::field::value::type::integer, 8, 2)
                 .set_default_value([] (rsrc::data& data) {
                     data.write_signed_word(5);
@@ -74,10 +75,7 @@ rsrc::data kdk::asteroid::assemble()
                 .set_default_value([] (rsrc::data& data) {
                     data.write_long(0x00FFFFFF);
                 }),
-        })
-	);
-    
-    assembler::assemble(
+        }),
         kdk::assembler::field::named("fragments").set_required(false).set_values({
             kdk::assembler::field::value::expect("count", kdk::assembler::field::value::type::integer, 18, 2)
                 .set_default_value([] (rsrc::data& data) {
@@ -87,6 +85,7 @@ rsrc::data kdk::asteroid::assemble()
                     std::make_tuple("none", 0)
                 }),
             kdk::assembler::field::value::expect("fragment_1", kdk::assembler::field::value::type::resource_reference, 14, 2)
+                .set_reference_type("Asteroid")
                 .set_default_value([] (rsrc::data& data) {
                     data.write_signed_word(-1);
                 })
@@ -94,29 +93,27 @@ rsrc::data kdk::asteroid::assemble()
                     std::make_tuple("unused", -1)
                 }),
             kdk::assembler::field::value::expect("fragment_2", kdk::assembler::field::value::type::resource_reference, 16, 2)
+                .set_reference_type("Asteroid")
                 .set_default_value([] (rsrc::data& data) {
                     data.write_signed_word(-1);
                 })
                 .set_symbols({
                     std::make_tuple("unused", -1)
                 }),
-        })
-    );
-    
-    assembler::assemble(
+        }),
         kdk::assembler::field::named("explosion").set_values({
             kdk::assembler::field::value::expect("value", kdk::assembler::field::value::type::integer, 20, 2)
                 .set_symbols({
                     std::make_tuple("none", -1)
                 }),
-        })
-    );
-    
-    assembler::assemble(
+        }),
         kdk::assembler::field::named("mass").set_values({
             kdk::assembler::field::value::expect("value", kdk::assembler::field::value::type::integer, 22, 2)
         })
-    );
+    };
+    
+    // Handle each of the fields in the resource.
+    assembler::assemble(layout);
     
     // Finish assembly and return the result to the caller.
     return assembler::assemble();
@@ -21,39 +21,42 @@
 */
 
 #include "assemblers/sprite_animation.hpp"
+#include "assemblers/assembler_registry.hpp"
+
+// MARK: - Registration
+
+namespace
+{
+
+const kdk::assembler_registry::registration<kdk::sprite_animation> registration { "SpriteAnimation", "spïn" };
+
+};
 
 // MARK: - Assembly
 
 rsrc::data kdk::sprite_animation::assemble()
 {
-    // Handle each of the fields in the resource.
-    assembler::assemble(
+    // The layout is the same for every resource of the type, so it is only built once.
+    static const std::vector<kdk::assembler::field> layout {
         kdk::assembler::field::named("sprites").set_required(true).set_values({
             kdk::assembler::field::value::expect("sprite_id", kdk::assembler::field::value::type::resource_reference, 0, 2)
-        })
-	);
-
-    assembler::assemble(
-		// The 'masks' field is intended to be deprecated by Kestrel and thus should be warned about.
+        }),
+        // The 'masks' field is intended to be deprecated by Kestrel and thus should be warned about.
         kdk::assembler::field::named("masks").set_required(false).set_deprecated(true).set_values({
             kdk::assembler::field::value::expect("mask_id", kdk::assembler::field::value::type::resource_reference, 2, 2)
-        })
-	);
-    
-    assembler::assemble(
+        }),
         kdk::assembler::field::named("size").set_required(true).set_values({
             kdk::assembler::field::value::expect("width", kdk::assembler::field::value::type::integer, 4, 2),
             kdk::assembler::field::value::expect("height", kdk::assembler::field::value::type::integer, 6, 2),
-        })
-	);
-    
-    assembler::assemble(
+        }),
         kdk::assembler::field::named("tiles").set_required(true).set_values({
             kdk::assembler::field::value::expect("x_count", kdk::assembler::field::value::type::integer, 8, 2),
             kdk::assembler::field::value::expect("y_count", kdk::assembler::field::value::type::integer, 10, 2),
         })
-    );
+    };
     
+    // Handle each of the fields in the resource.
+    assembler::assemble(layout);
     
     // Finish assembly and return the result to the caller.
     return assembler::assemble();
@@ -21,8 +21,43 @@
 */
 
 #include <iostream>
+#include <mutex>
 #include "diagnostic/log.hpp"
 
+// MARK: - Error Reporting
+
+namespace
+{
+
+/**
+ * Work that is spread across threads captures its errors, and reports them once the
+ * threads have finished. Should an error still be raised from several threads at once,
+ * only the first of them is reported: the lock is never released, and so any other
+ * thread raising an error waits here until the process exits.
+ */
+void claim_error_reporting()
+{
+    static auto lock = new std::mutex;
+    lock->lock();
+}
+
+/**
+ * The innermost capture of the current thread, if there is one.
+ */
+thread_local log::capture *active_capture = nullptr;
+
+/**
+ * Print an error message for the specified location.
+ */
+void print_error(const std::string& location, const std::string& message)
+{
+    std::cout << "\x1b[31m" << "Error: " << location << std::endl << "\x1b[0m  " << message << std::endl;
+}
+
+};
+
+// MARK: - Diagnostics
+
 void log::warning(const std::string file, const int line, const std::string message)
 {
     std::cout << "\x1b[33m" << "Warning: " << file << ":L" << std::to_string(line) << std::endl << "\x1b[0m  " << message << std::endl;
@@ -30,6 +65,126 @@ void log::warning(const std::string file, const int line, const std::string mess
 
 void log::error(const std::string file, const int line, const std::string message)
 {
-    std::cout << "\x1b[31m" << "Error: " << file << ":L" << std::to_string(line) << std::endl << "\x1b[0m  " << message << std::endl;
+    if (active_capture) {
+        log::diagnostic diagnostic;
+        diagnostic.path = file;
+        diagnostic.line = line;
+        diagnostic.message = message;
+        active_capture->add(std::move(diagnostic));
+        throw log::capture::aborted();
+    }
+    
+    claim_error_reporting();
+    print_error(file + ":L" + std::to_string(line), message);
+    exit(1);
+}
+
+// MARK: - Source Locations
+
+namespace
+{
+
+/**
+ * Describe a location in a source buffer, in the form `path:L<line>:C<column>`.
+ */
+std::string describe(const kdl::source_manager::file_id file, const uint32_t offset)
+{
+    if (file == kdl::source_manager::invalid_file) {
+        return "<unknown>:L0";
+    }
+    
+    auto& sources = kdl::source_manager::shared();
+    auto loc = sources.locate(file, offset);
+    return sources.path(file) + ":L" + std::to_string(loc.line) + ":C" + std::to_string(loc.column);
+}
+
+};
+
+void log::warning(const kdl::source_manager::file_id file, const uint32_t offset, const std::string message)
+{
+    std::cout << "\x1b[33m" << "Warning: " << describe(file, offset) << std::endl << "\x1b[0m  " << message << std::endl;
+}
+
+void log::error(const kdl::source_manager::file_id file, const uint32_t offset, const std::string message, bool terminate)
+{
+    if (active_capture) {
+        log::diagnostic diagnostic;
+        diagnostic.file = file;
+        diagnostic.offset = offset;
+        diagnostic.message = message;
+        active_capture->add(std::move(diagnostic));
+        if (terminate) {
+            throw log::capture::aborted();
+        }
+        return;
+    }
+    
+    if (terminate) {
+        claim_error_reporting();
+    }
+    
+    print_error(describe(file, offset), message);
+    
+    if (terminate) {
+        exit(1);
+    }
+}
+
+// MARK: - Capturing Errors
+
+std::string log::diagnostic::location() const
+{
+    if (file == kdl::source_manager::invalid_file && !path.empty()) {
+        return path + ":L" + std::to_string(line);
+    }
+    return describe(file, offset);
+}
+
+log::capture::capture()
+    : m_previous(active_capture)
+{
+    active_capture = this;
+}
+
+log::capture::~capture()
+{
+    active_capture = m_previous;
+}
+
+const std::vector<log::diagnostic>& log::capture::diagnostics() const
+{
+    return m_diagnostics;
+}
+
+std::vector<log::diagnostic> log::capture::take_diagnostics()
+{
+    auto diagnostics = std::move(m_diagnostics);
+    m_diagnostics.clear();
+    return diagnostics;
+}
+
+void log::capture::add(log::diagnostic diagnostic)
+{
+    m_diagnostics.push_back(std::move(diagnostic));
+}
+
+void log::report(const std::vector<log::diagnostic>& diagnostics)
+{
+    if (diagnostics.empty()) {
+        return;
+    }
+    
+    // A capture on this thread takes the errors over, as it would any other error.
+    if (active_capture) {
+        for (const auto& diagnostic : diagnostics) {
+            active_capture->add(diagnostic);
+        }
+        throw log::capture::aborted();
+    }
+    
+    claim_error_reporting();
+    for (const auto& diagnostic : diagnostics) {
+        print_error(diagnostic.location(), diagnostic.message);
+    }
     exit(1);
 }
@@ -21,6 +21,9 @@
 */
 
 #include <string>
+#include <vector>
+#include <cstdint>
+#include "kdl/source_manager.hpp"
 
 #if !defined(KDK_DIAGNOSTIC_LOG)
 #define KDK_DIAGNOSTIC_LOG
@@ -38,6 +41,89 @@ void warning(const std::string file, const int line, const std::string message);
  */
 void error(const std::string file, const int line, const std::string message);
 
+/**
+ * Prints a warning message about a location in a source buffer to the standard output.
+ * The line and column of the location are only looked up when the message is printed.
+ */
+void warning(const kdl::source_manager::file_id file, const uint32_t offset, const std::string message);
+
+/**
+ * Prints an error message about a location in a source buffer to the standard output,
+ * and then terminates the program. When reporting several errors together, all but the
+ * last of them can be printed without terminating.
+ */
+void error(const kdl::source_manager::file_id file, const uint32_t offset, const std::string message, bool terminate = true);
+
+// MARK: - Capturing Errors
+
+/**
+ * An error that was captured rather than reported. The location is either an offset in a
+ * source buffer, or a path and line for errors that are not about a source buffer.
+ */
+struct diagnostic
+{
+    kdl::source_manager::file_id file { kdl::source_manager::invalid_file };
+    uint32_t offset { 0 };
+    std::string path;
+    int line { 0 };
+    std::string message;
+    
+    /**
+     * Returns a description of the location of the error, such as `path:L<line>:C<column>`.
+     */
+    std::string location() const;
+};
+
+/**
+ * While a capture exists, errors raised on the thread that created it are collected by
+ * the capture rather than printed. An error that would have terminated the program throws
+ * log::capture::aborted instead, unwinding back to the owner of the capture.
+ *
+ * This allows work that is done away from the main thread to hand its errors back to be
+ * reported once every thread has finished, and allows tooling to survive errors in the
+ * sources that it is given.
+ */
+class capture
+{
+public:
+    /**
+     * Thrown in place of terminating the program when an error is captured.
+     */
+    struct aborted {};
+    
+public:
+    capture();
+    ~capture();
+    
+    capture(const capture&) = delete;
+    capture& operator=(const capture&) = delete;
+    
+    /**
+     * Returns the errors that have been captured, in the order that they were raised.
+     */
+    const std::vector<log::diagnostic>& diagnostics() const;
+    
+    /**
+     * Move the errors that have been captured out of the capture.
+     */
+    std::vector<log::diagnostic> take_diagnostics();
+    
+    /**
+     * Add an error to the capture.
+     */
+    void add(log::diagnostic diagnostic);
+    
+private:
+    log::capture *m_previous { nullptr };
+    std::vector<log::diagnostic> m_diagnostics;
+};
+
+/**
+ * Print each of the specified errors, and then terminate the program if there were any.
+ * This must only be called once no other thread can still be raising errors.
+ */
+void report(const std::vector<log::diagnostic>& diagnostics);
+
 };
 
 #endif
@@ -0,0 +1,560 @@
+/*
+* Copyright (c) 2019 Tom Hancocks
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <functional>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <vector>
+#include <utility>
+#include <tuple>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "kdl/cache.hpp"
+#include "version.hpp"
+
+// MARK: - Cache Format
+
+namespace
+{
+
+/**
+ * Identifies a cache file, and the revision of the layout that it uses. The revision must
+ * be bumped whenever the layout below changes.
+ */
+constexpr char cache_magic[4] = { 'K', 'D', 'L', 'C' };
+constexpr uint32_t cache_format = 6;
+
+/**
+ * Accumulates the contents of a cache file. The key is written as fixed size values in the
+ * native byte order, as a cache file is only ever read back on the machine that wrote it.
+ * The model itself is written using variable length integers, and the text of the model
+ * is written as the distance from the previous text in the source, which keeps the cache
+ * file compact.
+ */
+struct writer
+{
+    std::string bytes;
+    std::string_view source;
+    int64_t previous_offset { 0 };
+    
+    template<typename T>
+    void put(T value)
+    {
+        bytes.append(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+    
+    void put_varint(uint64_t value)
+    {
+        while (value >= 0x80) {
+            bytes.push_back(static_cast<char>((value & 0x7F) | 0x80));
+            value >>= 7;
+        }
+        bytes.push_back(static_cast<char>(value));
+    }
+    
+    void put_signed_varint(int64_t value)
+    {
+        put_varint((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+    }
+    
+    void put_string(std::string_view str)
+    {
+        put_varint(str.size());
+        bytes.append(str);
+    }
+    
+    void put_text(std::string_view text)
+    {
+        // Text is either a distance in the source, tagged with a clear low bit, or text that
+        // does not lie within the source and so is stored inline, tagged with a set low bit.
+        std::less<const char *> before;
+        if (text.data() && !before(text.data(), source.data()) && !before(source.data() + source.size(), text.data() + text.size())) {
+            auto offset = static_cast<int64_t>(text.data() - source.data());
+            put_signed_varint((offset - previous_offset) * 2);
+            put_varint(text.size());
+            previous_offset = offset;
+        }
+        else {
+            put_signed_varint(1);
+            put_string(text);
+        }
+    }
+};
+
+/**
+ * Reads back the contents of a cache file. Every read is bounds checked, so that a
+ * truncated or damaged cache file is rejected rather than trusted.
+ */
+struct reader
+{
+    const char *ptr;
+    const char *end;
+    std::string_view source;
+    kdk::arena& arena;
+    
+    int64_t previous_offset { 0 };
+    
+    template<typename T>
+    bool get(T& value)
+    {
+        if (static_cast<std::size_t>(end - ptr) < sizeof(T)) {
+            return false;
+        }
+        std::memcpy(&value, ptr, sizeof(T));
+        ptr += sizeof(T);
+        return true;
+    }
+    
+    template<typename T>
+    bool get_varint(T& value)
+    {
+        uint64_t result = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            if (ptr == end) {
+                return false;
+            }
+            auto byte = static_cast<uint8_t>(*ptr++);
+            result |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) {
+                value = static_cast<T>(result);
+                return static_cast<uint64_t>(value) == result;
+            }
+        }
+        return false;
+    }
+    
+    bool get_signed_varint(int64_t& value)
+    {
+        uint64_t encoded;
+        if (!get_varint(encoded)) {
+            return false;
+        }
+        value = static_cast<int64_t>(encoded >> 1) ^ -static_cast<int64_t>(encoded & 1);
+        return true;
+    }
+    
+    bool get_bytes(std::size_t size, std::string_view& bytes)
+    {
+        if (static_cast<std::size_t>(end - ptr) < size) {
+            return false;
+        }
+        bytes = std::string_view(ptr, size);
+        ptr += size;
+        return true;
+    }
+    
+    bool get_string(std::string_view& str)
+    {
+        std::size_t size;
+        return get_varint(size) && get_bytes(size, str);
+    }
+    
+    bool get_text(std::string_view& text)
+    {
+        int64_t tag;
+        if (!get_signed_varint(tag)) {
+            return false;
+        }
+        
+        if (tag & 1) {
+            // Inline text has to outlive the cache file, so it is copied in to the arena.
+            std::string_view bytes;
+            if (!get_string(bytes)) {
+                return false;
+            }
+            text = std::string_view(arena.copy(bytes.data(), bytes.size()).data(), bytes.size());
+            return true;
+        }
+        
+        std::size_t size;
+        auto offset = previous_offset + tag / 2;
+        if (!get_varint(size) || offset < 0 || static_cast<uint64_t>(offset) > source.size() || size > source.size() - offset) {
+            return false;
+        }
+        text = source.substr(offset, size);
+        previous_offset = offset;
+        return true;
+    }
+};
+
+/**
+ * Returns true if the value type holds text rather than a number.
+ */
+bool is_textual(kdk::resource::field::value_type type)
+{
+    return type == kdk::resource::field::value_type::string
+        || type == kdk::resource::field::value_type::identifier
+        || type == kdk::resource::field::value_type::file_reference
+        || type == kdk::resource::field::value_type::expression;
+}
+
+};
+
+// MARK: - Constructor
+
+kdl::cache::cache(std::string directory)
+    : m_directory(directory)
+{
+    
+}
+
+// MARK: - Hashing
+
+uint64_t kdl::cache::hash(std::string_view bytes)
+{
+    // Consume the bytes a word at a time, mixing each word in to the running hash, and then
+    // finish with an avalanche so that every input bit affects every output bit.
+    constexpr uint64_t k0 = 0x9E3779B97F4A7C15ULL;
+    constexpr uint64_t k1 = 0xFF51AFD7ED558CCDULL;
+    constexpr uint64_t k2 = 0xC4CEB9FE1A85EC53ULL;
+    
+    auto h = static_cast<uint64_t>(bytes.size()) * k0;
+    auto ptr = bytes.data();
+    auto remaining = bytes.size();
+    
+    while (remaining > 0) {
+        uint64_t word = 0;
+        auto n = std::min<std::size_t>(remaining, sizeof(word));
+        std::memcpy(&word, ptr, n);
+        ptr += n;
+        remaining -= n;
+        
+        h ^= word * k1;
+        h = ((h << 31) | (h >> 33)) * k0;
+    }
+    
+    h ^= h >> 33;
+    h *= k2;
+    h ^= h >> 33;
+    return h;
+}
+
+// MARK: - Paths
+
+std::string kdl::cache::path_for(kdl::source_manager::file_id file) const
+{
+    // Name the cache file after the absolute path of the source, so that each source file
+    // has exactly one cache file regardless of how it was referred to.
+    auto path = kdl::source_manager::shared().path(file);
+    char resolved[PATH_MAX];
+    if (realpath(path.c_str(), resolved)) {
+        path = resolved;
+    }
+    
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hash(path)));
+    return m_directory + "/" + name + ".kdlc";
+}
+
+// MARK: - Loading
+
+bool kdl::cache::load(kdl::source_manager::file_id file, kdk::target& target, std::vector<kdl::lexer::token>& imports) const
+{
+    auto source = kdl::source_manager::shared().contents(file);
+    
+    int fd = open(path_for(file).c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    
+    auto size = static_cast<std::size_t>(info.st_size);
+    auto mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    
+    reader in { static_cast<const char *>(mapping), static_cast<const char *>(mapping) + size, source, target.arena() };
+    
+    // Check the key of the cache file before reading anything else from it.
+    std::string_view magic, version;
+    uint32_t format;
+    uint64_t source_hash, source_size, count, model_hash;
+    auto valid = in.get_bytes(sizeof(cache_magic), magic) && magic == std::string_view(cache_magic, sizeof(cache_magic))
+              && in.get(format) && format == cache_format
+              && in.get_string(version) && version == KAS_VERSION
+              && in.get(source_size) && source_size == source.size()
+              && in.get(source_hash) && source_hash == hash(source)
+              && in.get(count)
+              && in.get(model_hash) && model_hash == hash(std::string_view(in.ptr, in.end - in.ptr));
+    
+    std::vector<kdk::resource> resources;
+    std::vector<std::tuple<kdk::atom, std::string_view, std::size_t>> fields;
+    std::vector<kdk::resource::field::value> values;
+    std::vector<kdk::atom> variants;
+    
+    for (uint64_t n = 0; valid && n < count; ++n) {
+        std::string_view type, name, source_text;
+        int64_t id;
+        uint32_t field_count;
+        
+        uint32_t variant_count;
+        valid = in.get_string(type) && in.get_signed_varint(id) && in.get_string(name) && in.get_text(source_text) && in.get_varint(variant_count);
+        
+        fields.clear();
+        values.clear();
+        variants.clear();
+        
+        for (uint32_t v = 0; valid && v < variant_count; ++v) {
+            std::string_view variant;
+            valid = in.get_string(variant);
+            variants.emplace_back(variant);
+        }
+        
+        uint8_t has_base, is_range;
+        int64_t base_id { 0 }, range_last { 0 };
+        std::string_view name_template;
+        valid = valid && in.get(has_base) && (!has_base || in.get_signed_varint(base_id))
+                      && in.get(is_range) && (!is_range || (in.get_signed_varint(range_last) && in.get_text(name_template) && range_last >= id))
+                      && in.get_varint(field_count);
+        
+        for (uint32_t f = 0; valid && f < field_count; ++f) {
+            std::string_view field_name;
+            uint32_t value_count;
+            valid = in.get_text(field_name) && in.get_varint(value_count);
+            
+            for (uint32_t v = 0; valid && v < value_count; ++v) {
+                uint8_t value_type;
+                valid = in.get(value_type) && value_type <= kdk::resource::field::value_type::expression;
+                if (!valid) {
+                    break;
+                }
+                
+                auto type = static_cast<kdk::resource::field::value_type>(value_type);
+                if (type == kdk::resource::field::value_type::identifier) {
+                    std::string_view text;
+                    valid = in.get_text(text);
+                    values.emplace_back(text, kdk::atom(text));
+                }
+                else if (is_textual(type)) {
+                    std::string_view text;
+                    valid = in.get_text(text);
+                    values.emplace_back(type, text);
+                }
+                else {
+                    int64_t number;
+                    valid = in.get_signed_varint(number);
+                    values.emplace_back(type, number);
+                }
+            }
+            
+            fields.emplace_back(kdk::atom(field_name), field_name, value_count);
+        }
+        
+        if (valid) {
+            kdk::resource resource { kdk::atom(type), id, std::string(name) };
+            resource.set_source(file, source_text);
+            resource.set_fields(target.arena(), fields, values);
+            resource.set_variants(target.arena().copy(variants.data(), variants.size()));
+            if (has_base) {
+                resource.set_base_id(base_id);
+            }
+            if (is_range) {
+                resource.set_range(target.arena(), range_last, name_template);
+            }
+            resources.push_back(std::move(resource));
+        }
+    }
+    
+    uint32_t import_count;
+    std::vector<kdl::lexer::token> imported;
+    valid = valid && in.get_varint(import_count);
+    
+    for (uint32_t n = 0; valid && n < import_count; ++n) {
+        // The name of an imported file is always a token in the source.
+        std::string_view path;
+        std::less<const char *> before;
+        valid = in.get_text(path) && !before(path.data(), source.data()) && !before(source.data() + source.size(), path.data() + path.size());
+        imported.emplace_back(file, static_cast<uint32_t>(path.data() - source.data()), static_cast<uint32_t>(path.size()), kdl::lexer::token::type::string);
+    }
+    
+    uint32_t declared_count;
+    std::vector<kdk::atom> declared;
+    valid = valid && in.get_varint(declared_count);
+    
+    for (uint32_t n = 0; valid && n < declared_count; ++n) {
+        std::string_view variant;
+        valid = in.get_string(variant);
+        declared.emplace_back(variant);
+    }
+    
+    uint32_t constant_count;
+    std::vector<kdk::target::constant> defined;
+    valid = valid && in.get_varint(constant_count);
+    
+    for (uint32_t n = 0; valid && n < constant_count; ++n) {
+        std::string_view name;
+        uint32_t offset;
+        uint8_t value_type;
+        valid = in.get_string(name) && in.get_varint(offset) && offset < source.size()
+             && in.get(value_type) && value_type <= kdk::resource::field::value_type::expression;
+        if (!valid) {
+            break;
+        }
+        
+        // A constant is either already folded, or is an expression given in the source.
+        auto type = static_cast<kdk::resource::field::value_type>(value_type);
+        if (is_textual(type)) {
+            std::string_view text;
+            valid = in.get_text(text);
+            defined.push_back({ kdk::atom(name), file, offset, kdk::resource::field::value(type, text) });
+        }
+        else {
+            int64_t number;
+            valid = in.get_signed_varint(number);
+            defined.push_back({ kdk::atom(name), file, offset, kdk::resource::field::value(type, number) });
+        }
+    }
+    
+    munmap(mapping, size);
+    
+    if (!valid || in.ptr != in.end) {
+        return false;
+    }
+    
+    target.add_resources(std::move(resources));
+    for (auto variant : declared) {
+        target.declare_variant(variant);
+    }
+    for (const auto& constant : defined) {
+        target.define_constant(constant);
+    }
+    imports.insert(std::end(imports), std::begin(imported), std::end(imported));
+    return true;
+}
+
+// MARK: - Storing
+
+void kdl::cache::store(kdl::source_manager::file_id file, const kdk::target& target, const std::vector<kdl::lexer::token>& imports) const
+{
+    auto source = kdl::source_manager::shared().contents(file);
+    
+    writer out;
+    out.source = source;
+    out.bytes.append(cache_magic, sizeof(cache_magic));
+    out.put(cache_format);
+    out.put_string(KAS_VERSION);
+    out.put(static_cast<uint64_t>(source.size()));
+    out.put(hash(source));
+    // A range of resources is stored once, as its prototype, rather than once per resource.
+    auto stored = std::count_if(std::begin(target.resources()), std::end(target.resources()), [] (const kdk::resource& resource) {
+        return !resource.range() || resource.id() == resource.range()->first;
+    });
+    out.put(static_cast<uint64_t>(stored));
+    
+    // The model is preceded by a hash of itself, so that a damaged cache file is rejected.
+    auto model_start = out.bytes.size() + sizeof(uint64_t);
+    out.put(uint64_t(0));
+    
+    for (const auto& resource : target.resources()) {
+        auto range = resource.range();
+        if (range && resource.id() != range->first) {
+            continue;
+        }
+        
+        out.put_string(resource.type().text());
+        out.put_signed_varint(resource.id());
+        out.put_string(resource.name());
+        out.put_text(resource.source_text());
+        out.put_varint(resource.variants().size());
+        for (auto variant : resource.variants()) {
+            out.put_string(variant.text());
+        }
+        out.put(static_cast<uint8_t>(resource.has_base()));
+        if (resource.has_base()) {
+            out.put_signed_varint(resource.base_id());
+        }
+        out.put(static_cast<uint8_t>(range != nullptr));
+        if (range) {
+            out.put_signed_varint(range->last);
+            out.put_text(range->name);
+        }
+        out.put_varint(resource.fields().size());
+        
+        for (const auto& field : resource.fields()) {
+            out.put_text(field.source_text());
+            out.put_varint(field.values().size());
+            
+            for (const auto& value : field.values()) {
+                out.put(static_cast<uint8_t>(value.type()));
+                if (is_textual(value.type())) {
+                    out.put_text(value.text());
+                }
+                else {
+                    out.put_signed_varint(value.number());
+                }
+            }
+        }
+    }
+    
+    out.put_varint(imports.size());
+    for (const auto& path : imports) {
+        out.put_text(path.text());
+    }
+    
+    out.put_varint(target.variants().size());
+    for (auto variant : target.variants()) {
+        out.put_string(variant.text());
+    }
+    
+    out.put_varint(target.constants().size());
+    for (const auto& constant : target.constants()) {
+        out.put_string(constant.name.text());
+        out.put_varint(constant.offset);
+        out.put(static_cast<uint8_t>(constant.value.type()));
+        if (is_textual(constant.value.type())) {
+            out.put_text(constant.value.text());
+        }
+        else {
+            out.put_signed_varint(constant.value.number());
+        }
+    }
+    
+    auto model_hash = hash(std::string_view(out.bytes).substr(model_start));
+    std::memcpy(&out.bytes[model_start - sizeof(model_hash)], &model_hash, sizeof(model_hash));
+    
+    // Write the cache file under a temporary name and then move it in to place, so that
+    // a partially written cache file is never seen.
+    mkdir(m_directory.c_str(), 0755);
+    auto path = path_for(file);
+    auto temporary = path + "." + std::to_string(getpid());
+    
+    std::ofstream f(temporary, std::ios::out | std::ios::binary);
+    f.write(out.bytes.data(), out.bytes.size());
+    f.close();
+    
+    if (!f || rename(temporary.c_str(), path.c_str()) != 0) {
+        unlink(temporary.c_str());
+    }
+}
@@ -0,0 +1,92 @@
+/*
+* Copyright (c) 2019 Tom Hancocks
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <vector>
+#include "kdl/source_manager.hpp"
+#include "kdl/lexer.hpp"
+#include "structures/target.hpp"
+
+#if !defined(KDL_CACHE)
+#define KDL_CACHE
+
+namespace kdl
+{
+
+/**
+ * A persistent cache of the parsed model of source files, held in a directory of cache
+ * files. Each cache file holds the resources produced by a single source file, and is
+ * keyed by a hash of the source bytes along with the version of the assembler. When the
+ * source is unchanged the resources can be read straight back in to a target, without
+ * lexing or parsing the source at all.
+ *
+ * Textual parts of the model (field names, strings, identifiers, etc) are stored as
+ * offsets in to the source, which is known to be identical whenever the cache is used.
+ * The files imported by the source are stored alongside its resources, so that the import
+ * graph can be followed without parsing any of the files in it.
+ *
+ * Directives are not replayed when the model is read from the cache, so any messages that
+ * they would have printed are not printed again.
+ */
+class cache
+{
+public:
+    /**
+     * Construct a new cache that keeps its cache files in the specified directory.
+     */
+    cache(std::string directory);
+    
+    /**
+     * Read the cached resources of the specified source file in to the target, and the
+     * files that it imports in to `imports`. Returns false if there are no cached resources
+     * for the current contents of the file, or the cache file could not be used, in which
+     * case neither the target nor the imports are touched.
+     */
+    bool load(kdl::source_manager::file_id file, kdk::target& target, std::vector<kdl::lexer::token>& imports) const;
+    
+    /**
+     * Write the resources of the target to the cache, as the resources produced by the
+     * specified source file, along with the files that it imports. Failing to write the
+     * cache is not an error.
+     */
+    void store(kdl::source_manager::file_id file, const kdk::target& target, const std::vector<kdl::lexer::token>& imports) const;
+    
+    /**
+     * Returns a fast, non-cryptographic 64-bit hash of the specified bytes.
+     */
+    static uint64_t hash(std::string_view bytes);
+    
+private:
+    /**
+     * Returns the path of the cache file for the specified source file.
+     */
+    std::string path_for(kdl::source_manager::file_id file) const;
+    
+private:
+    std::string m_directory;
+};
+
+};
+
+#endif
@@ -0,0 +1,420 @@
+/*
+* Copyright (c) 2019 Tom Hancocks
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <algorithm>
+#include "kdl/document.hpp"
+#include "kdl/sema.hpp"
+#include "kdl/sema/expression.hpp"
+
+// MARK: - Helpers
+
+namespace
+{
+
+/**
+ * Describe the definition of a constant, so that changes to it can be detected.
+ */
+std::string signature(const kdk::target::constant& constant)
+{
+    const auto& value = constant.value;
+    if (value.type() == kdk::resource::field::value_type::expression) {
+        return constant.name.str() + "=" + std::string(value.text());
+    }
+    return constant.name.str() + "=" + std::to_string(static_cast<int>(value.type())) + ":" + std::to_string(value.number());
+}
+
+};
+
+// MARK: - Constructor
+
+kdl::document::document(kdk::target target, kdl::source_manager::file_id file)
+    : m_file(file), m_target(std::move(target))
+{
+    // A lexical error ends the tokens at the error.
+    std::vector<kdl::lexer::token> tokens;
+    {
+        log::capture capture;
+        try {
+            kdl::lexer lexer(m_file);
+            kdl::lexer::token tk;
+            while (lexer.next(tk)) {
+                tokens.push_back(tk);
+            }
+        }
+        catch (const log::capture::aborted&) {
+            m_lexical_error = capture.diagnostics().back();
+        }
+    }
+    
+    splice(0, 0, split_blocks(tokens));
+}
+
+// MARK: - Accessors
+
+std::vector<kdl::lexer::token> kdl::document::tokens() const
+{
+    std::vector<kdl::lexer::token> tokens;
+    for (const auto& b : m_blocks) {
+        for (std::size_t n = 0; n < b.tokens.size(); ++n) {
+            tokens.push_back(b.token(n));
+        }
+    }
+    return tokens;
+}
+
+kdk::target& kdl::document::target()
+{
+    return m_target;
+}
+
+std::vector<kdl::lexer::token> kdl::document::imports() const
+{
+    std::vector<kdl::lexer::token> imports;
+    for (const auto& b : m_blocks) {
+        imports.insert(std::end(imports), std::begin(b.imports), std::end(b.imports));
+    }
+    return imports;
+}
+
+std::vector<log::diagnostic> kdl::document::diagnostics() const
+{
+    std::vector<log::diagnostic> diagnostics;
+    for (const auto& b : m_blocks) {
+        diagnostics.insert(std::end(diagnostics), std::begin(b.diagnostics), std::end(b.diagnostics));
+    }
+    diagnostics.insert(std::end(diagnostics), std::begin(m_definition_errors), std::end(m_definition_errors));
+    if (m_lexical_error) {
+        diagnostics.push_back(*m_lexical_error);
+    }
+    return diagnostics;
+}
+
+// MARK: - Blocks
+
+kdl::lexer::token kdl::document::block::token(std::size_t n) const
+{
+    auto tk = tokens[n];
+    tk.relocate(offset_delta);
+    return tk;
+}
+
+void kdl::document::block::relocate(const char *begin, const char *end, const char *destination, int64_t delta)
+{
+    offset_delta += delta;
+    
+    for (auto& constant : constants) {
+        constant.offset = static_cast<uint32_t>(static_cast<int64_t>(constant.offset) + delta);
+        constant.value.relocate_text(begin, end, destination);
+    }
+    for (auto& tk : imports) {
+        tk.relocate(delta);
+    }
+    for (auto& diagnostic : diagnostics) {
+        if (diagnostic.file != kdl::source_manager::invalid_file) {
+            diagnostic.offset = static_cast<uint32_t>(static_cast<int64_t>(diagnostic.offset) + delta);
+        }
+    }
+}
+
+std::vector<kdl::document::block> kdl::document::split_blocks(const std::vector<kdl::lexer::token>& tokens)
+{
+    std::vector<kdl::document::block> blocks;
+    
+    for (std::size_t first = 0; first < tokens.size(); ) {
+        auto closed = false;
+        auto count = kdl::sema::measure_block(kdk::span<const kdl::lexer::token>(tokens.data(), tokens.size()), first, closed);
+        
+        // Each block is parsed on its own, so that it can be re-parsed later on without
+        // needing to revisit any of the others.
+        block b;
+        b.tokens.assign(std::begin(tokens) + first, std::begin(tokens) + first + count);
+        first += count;
+        parse_block(b);
+        blocks.push_back(std::move(b));
+    }
+    
+    return blocks;
+}
+
+void kdl::document::parse_block(block& b)
+{
+    // Apply any pending movement to the tokens, as the parsed model refers to them.
+    for (auto& tk : b.tokens) {
+        tk.relocate(b.offset_delta);
+    }
+    b.offset_delta = 0;
+    
+    b.arena = std::make_shared<kdk::arena>();
+    b.resources.clear();
+    b.constants.clear();
+    b.variants.clear();
+    b.imports.clear();
+    
+    log::capture capture;
+    try {
+        kdl::sema sema(kdk::target("", b.arena), kdk::span<const kdl::lexer::token>(b.tokens.data(), b.tokens.size()));
+        sema.run();
+        b.resources = sema.target().take_resources();
+        b.constants = sema.target().constants();
+        b.variants = sema.target().variants();
+        b.imports = sema.imports();
+    }
+    catch (const log::capture::aborted&) {
+        b.resources.clear();
+    }
+    b.diagnostics = capture.take_diagnostics();
+}
+
+// MARK: - Editing
+
+void kdl::document::edit(uint32_t offset, uint32_t length, std::string_view text)
+{
+    auto& sources = kdl::source_manager::shared();
+    auto previous = sources.contents(m_file);
+    auto previous_begin = previous.data();
+    auto previous_end = previous.data() + previous.size();
+    
+    auto edit_end = static_cast<int64_t>(offset) + length;
+    auto inserted_end = static_cast<int64_t>(offset) + static_cast<int64_t>(text.size());
+    auto delta = inserted_end - edit_end;
+    
+    sources.replace(m_file, offset, length, text);
+    auto source = sources.contents(m_file);
+    
+    // Find the first block that touches the edit. Lexing restarts at the last token of the
+    // block before it, which is unaffected by the edit, so that any comment or whitespace
+    // between the two blocks is rescanned.
+    auto first_block = static_cast<std::size_t>(std::partition_point(std::begin(m_blocks), std::end(m_blocks), [&] (const block& b) {
+        return b.token(b.tokens.size() - 1).lexeme_end() < offset;
+    }) - std::begin(m_blocks));
+    
+    // The last block may have been left open, either by the end of the source or by a
+    // lexical error, in which case an edit beyond it continues it.
+    if (first_block == m_blocks.size() && first_block > 0) {
+        first_block--;
+    }
+    
+    auto skip = (first_block > 0);
+    auto restart = skip ? m_blocks[first_block - 1].token(m_blocks[first_block - 1].tokens.size() - 1) : kdl::lexer::token();
+    kdl::lexer lexer = skip
+        ? kdl::lexer(m_file, restart.lexeme_begin())
+        : kdl::lexer(m_file, 0);
+    
+    // Lex forwards until a new token starts at the same place as one of the old blocks past
+    // the end of the edit. The source is identical from that point on, as is the state of the
+    // lexer, so the old blocks from there on can be kept.
+    auto last_block = static_cast<std::size_t>(std::partition_point(std::begin(m_blocks) + first_block, std::end(m_blocks), [&] (const block& b) {
+        return b.token(0).lexeme_begin() < edit_end;
+    }) - std::begin(m_blocks));
+    auto synced = false;
+    
+    // A lexical error ends the new tokens at the error. Nothing after it can be kept, as the
+    // state of the lexer at the old blocks is not known.
+    std::vector<kdl::lexer::token> fresh;
+    std::optional<log::diagnostic> lexical_error;
+    {
+        log::capture capture;
+        try {
+            kdl::lexer::token tk;
+            while (lexer.next(tk)) {
+                if (skip) {
+                    skip = false;
+                    continue;
+                }
+                
+                auto begin = tk.lexeme_begin();
+                while (last_block < m_blocks.size() && m_blocks[last_block].token(0).lexeme_begin() + delta < begin) {
+                    last_block++;
+                }
+                if (last_block < m_blocks.size() && m_blocks[last_block].token(0).lexeme_begin() + delta == begin) {
+                    synced = true;
+                    break;
+                }
+                fresh.push_back(tk);
+            }
+        }
+        catch (const log::capture::aborted&) {
+            lexical_error = capture.diagnostics().back();
+        }
+    }
+    
+    // Any lexical error from before lies beyond the last block. It is only still valid if
+    // the lexer never reached it.
+    if (!synced) {
+        last_block = m_blocks.size();
+        m_lexical_error = lexical_error;
+    }
+    else if (m_lexical_error && m_lexical_error->file != kdl::source_manager::invalid_file) {
+        m_lexical_error->offset = static_cast<uint32_t>(static_cast<int64_t>(m_lexical_error->offset) + delta);
+    }
+    
+    // If the new tokens leave a block open, then it runs on in to the old blocks that were
+    // going to be kept. Absorb them until the block is closed.
+    for (std::size_t first = 0; first < fresh.size(); ) {
+        auto closed = false;
+        auto count = kdl::sema::measure_block(kdk::span<const kdl::lexer::token>(fresh.data(), fresh.size()), first, closed);
+        if (closed || last_block == m_blocks.size()) {
+            first += count;
+            continue;
+        }
+        
+        auto& absorbed = m_blocks[last_block++];
+        for (std::size_t n = 0; n < absorbed.tokens.size(); ++n) {
+            auto moved = absorbed.token(n);
+            moved.relocate(delta);
+            fresh.push_back(moved);
+        }
+    }
+    
+    // Resources and constants refer directly to text in the source buffer, so those of the
+    // blocks that were kept need to follow their text. Text ahead of the edit only moves if
+    // the buffer could not be edited in place.
+    auto first_resource = (first_block < m_blocks.size()) ? m_blocks[first_block].first_resource : m_target.resources().size();
+    auto kept = (last_block < m_blocks.size()) ? m_blocks[last_block].first_resource : m_target.resources().size();
+    if (source.data() != previous_begin) {
+        m_target.relocate_text(0, first_resource, previous_begin, previous_begin + offset, source.data());
+        for (std::size_t n = 0; n < first_block; ++n) {
+            m_blocks[n].relocate(previous_begin, previous_begin + offset, source.data(), 0);
+        }
+    }
+    if (source.data() != previous_begin || delta != 0) {
+        m_target.relocate_text(kept, m_target.resources().size() - kept, previous_begin + edit_end, previous_end, source.data() + inserted_end);
+        for (auto n = last_block; n < m_blocks.size(); ++n) {
+            m_blocks[n].relocate(previous_begin + edit_end, previous_end, source.data() + inserted_end, delta);
+        }
+    }
+    
+    splice(first_block, last_block, split_blocks(fresh));
+}
+
+void kdl::document::splice(std::size_t first, std::size_t last, std::vector<block> blocks)
+{
+    auto first_resource = (first < m_blocks.size()) ? m_blocks[first].first_resource : m_target.resources().size();
+    auto replaced = (last < m_blocks.size()) ? m_blocks[last].first_resource - first_resource : m_target.resources().size() - first_resource;
+    
+    // The arenas of the old blocks need to outlive their resources in the target.
+    std::vector<std::shared_ptr<kdk::arena>> released;
+    for (auto n = first; n < last; ++n) {
+        released.push_back(m_blocks[n].arena);
+    }
+    
+    auto end = first + blocks.size();
+    m_blocks.erase(std::begin(m_blocks) + first, std::begin(m_blocks) + last);
+    m_blocks.insert(std::begin(m_blocks) + first, std::make_move_iterator(std::begin(blocks)), std::make_move_iterator(std::end(blocks)));
+    
+    // Folding replaces expressions with their values, so if the constants have changed then
+    // every block needs to be parsed and folded again.
+    std::vector<kdk::target::constant> constants;
+    if (update_definitions(constants)) {
+        for (std::size_t n = 0; n < m_blocks.size(); ++n) {
+            if (n < first || n >= end) {
+                released.push_back(m_blocks[n].arena);
+                parse_block(m_blocks[n]);
+            }
+        }
+        first = 0;
+        end = m_blocks.size();
+        first_resource = 0;
+        replaced = m_target.resources().size();
+    }
+    
+    // Fold the new resources. A block with an error in an expression adds no resources.
+    std::vector<kdk::resource> resources;
+    for (auto n = first; n < end; ++n) {
+        auto& b = m_blocks[n];
+        log::capture capture;
+        try {
+            kdl::expression::fold(constants, b.resources);
+        }
+        catch (const log::capture::aborted&) {
+            b.resources.clear();
+        }
+        auto errors = capture.take_diagnostics();
+        b.diagnostics.insert(std::end(b.diagnostics), std::begin(errors), std::end(errors));
+        
+        b.first_resource = first_resource + resources.size();
+        b.resource_count = b.resources.size();
+        resources.insert(std::end(resources), std::make_move_iterator(std::begin(b.resources)), std::make_move_iterator(std::end(b.resources)));
+        b.resources.clear();
+    }
+    
+    auto resource_delta = static_cast<int64_t>(resources.size()) - static_cast<int64_t>(replaced);
+    for (auto n = end; n < m_blocks.size(); ++n) {
+        m_blocks[n].first_resource += resource_delta;
+    }
+    
+    // Resources that clash with others are still added to the target, and the clash is
+    // reported against the block that the resource came from.
+    log::capture capture;
+    try {
+        m_target.replace_resources(first_resource, replaced, std::move(resources));
+    }
+    catch (const log::capture::aborted&) {
+        
+    }
+    
+    for (auto& diagnostic : capture.take_diagnostics()) {
+        auto owner = std::find_if(std::begin(m_blocks) + first, std::begin(m_blocks) + end, [&] (const block& b) {
+            return diagnostic.offset >= b.token(0).lexeme_begin() && diagnostic.offset < b.token(b.tokens.size() - 1).lexeme_end();
+        });
+        if (owner == std::begin(m_blocks) + end) {
+            m_definition_errors.push_back(std::move(diagnostic));
+        }
+        else {
+            owner->diagnostics.push_back(std::move(diagnostic));
+        }
+    }
+}
+
+bool kdl::document::update_definitions(std::vector<kdk::target::constant>& folded)
+{
+    m_target.clear_definitions();
+    
+    log::capture capture;
+    std::vector<std::string> constant_signature;
+    for (const auto& b : m_blocks) {
+        for (auto variant : b.variants) {
+            m_target.declare_variant(variant);
+        }
+        for (const auto& constant : b.constants) {
+            constant_signature.push_back(signature(constant));
+            try {
+                m_target.define_constant(constant);
+            }
+            catch (const log::capture::aborted&) {
+                
+            }
+        }
+    }
+    
+    try {
+        folded = kdl::expression::fold_constants(m_target.constants());
+    }
+    catch (const log::capture::aborted&) {
+        folded = m_target.constants();
+    }
+    m_definition_errors = capture.take_diagnostics();
+    
+    auto changed = (constant_signature != m_constant_signature);
+    m_constant_signature = std::move(constant_signature);
+    return changed;
+}
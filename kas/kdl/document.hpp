@@ -0,0 +1,169 @@
+/*
+* Copyright (c) 2019 Tom Hancocks
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include "kdl/source_manager.hpp"
+#include "kdl/lexer.hpp"
+#include "structures/target.hpp"
+#include "diagnostic/log.hpp"
+
+#if !defined(KDL_DOCUMENT)
+#define KDL_DOCUMENT
+
+namespace kdl
+{
+
+/**
+ * A document holds the token stream and parsed resources of a single source buffer,
+ * and keeps both of them up to date as the source is edited. This is intended for
+ * editors and other tooling that need to apply small edits to large sources.
+ *
+ * An edit only re-lexes the source around the edited range, splicing the new tokens in
+ * to the existing stream, and then only re-parses the top level blocks (declarations
+ * and directives) that contain those tokens. The resulting resources replace those
+ * of the old blocks in the target, leaving every other resource in place.
+ *
+ * The target ends up as it would from a full parse of the source by `kdl::importer`:
+ * variants and constants are declared in the target, and expressions are folded. Folding
+ * replaces expressions with their values, so an edit that changes the constants of the
+ * document re-parses every block.
+ *
+ * Errors never terminate the program. Each is kept until the text that caused it is
+ * edited, and is available through `diagnostics`. A block that contains an error adds
+ * no resources to the target.
+ */
+class document
+{
+public:
+    /**
+     * Construct a new document for a source buffer held by the shared
+     * `kdl::source_manager`, lexing and parsing the entire buffer in to the target.
+     */
+    document(kdk::target target, kdl::source_manager::file_id file);
+    
+    /**
+     * Apply an edit to the source, replacing the specified number of bytes at the
+     * offset with new text, and bring the tokens and resources up to date.
+     */
+    void edit(uint32_t offset, uint32_t length, std::string_view text);
+    
+    /**
+     * Returns a copy of the current token stream of the document.
+     */
+    std::vector<kdl::lexer::token> tokens() const;
+    
+    /**
+     * Returns a reference to the target holding the resources of the document.
+     */
+    kdk::target& target();
+    
+    /**
+     * Returns the string tokens naming each of the files imported by the document, in
+     * source order. As with `kdl::sema`, the imported files are not loaded by the document.
+     */
+    std::vector<kdl::lexer::token> imports() const;
+    
+    /**
+     * Returns the errors in the current source. A resource that duplicates another is
+     * reported against whichever of the two was parsed last.
+     */
+    std::vector<log::diagnostic> diagnostics() const;
+    
+private:
+    /**
+     * A top level block of the source, such as a declaration or directive. Each block
+     * holds its own tokens, and records the run of resources in the target that it
+     * produced. The fields of those resources live in an arena owned by the block, so
+     * that they are released when the block is rebuilt.
+     *
+     * Edits ahead of a block move its tokens. Rather than update every token of every
+     * following block on each edit, the movement is accumulated on the block and only
+     * applied to the tokens when they are needed. Everything else that the block
+     * produced is moved straight away.
+     */
+    struct block
+    {
+        std::vector<kdl::lexer::token> tokens;
+        std::shared_ptr<kdk::arena> arena;
+        int64_t offset_delta { 0 };
+        std::size_t first_resource { 0 };
+        std::size_t resource_count { 0 };
+        std::vector<kdk::resource> resources;
+        std::vector<kdk::target::constant> constants;
+        std::vector<kdk::atom> variants;
+        std::vector<kdl::lexer::token> imports;
+        std::vector<log::diagnostic> diagnostics;
+        
+        /**
+         * Returns a copy of the specified token, with any pending movement applied.
+         */
+        kdl::lexer::token token(std::size_t n) const;
+        
+        /**
+         * Move everything that the block produced from the source text in [begin, end)
+         * to the same text at destination, which is offset_delta bytes further on.
+         */
+        void relocate(const char *begin, const char *end, const char *destination, int64_t offset_delta);
+    };
+    
+    /**
+     * Split a token stream in to blocks, and parse each of them. A block extends up to
+     * the brace that closes its first opening brace.
+     */
+    static std::vector<block> split_blocks(const std::vector<kdl::lexer::token>& tokens);
+    
+    /**
+     * Parse the tokens of a block, in to a fresh arena. Any error in the block is kept on
+     * the block, rather than reported.
+     */
+    static void parse_block(block& b);
+    
+    /**
+     * Replace the blocks [first, last) with the specified blocks, and their resources in
+     * the target with those of the new blocks.
+     */
+    void splice(std::size_t first, std::size_t last, std::vector<block> blocks);
+    
+    /**
+     * Declare the variants and constants of every block in the target, and fold the
+     * constants in to the specified vector. Returns true if the constants differ from those
+     * that were previously declared.
+     */
+    bool update_definitions(std::vector<kdk::target::constant>& folded);
+    
+private:
+    kdl::source_manager::file_id m_file;
+    std::vector<block> m_blocks;
+    kdk::target m_target;
+    std::optional<log::diagnostic> m_lexical_error;
+    std::vector<log::diagnostic> m_definition_errors;
+    std::vector<std::string> m_constant_signature;
+};
+
+};
+
+#endif
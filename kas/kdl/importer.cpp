@@ -0,0 +1,201 @@
+/*
+* Copyright (c) 2019 Tom Hancocks
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <climits>
+#include <cstdlib>
+#include "kdl/importer.hpp"
+#include "kdl/sema.hpp"
+#include "kdl/cache.hpp"
+#include "kdl/sema/expression.hpp"
+#include "diagnostic/log.hpp"
+
+// MARK: - Constructor
+
+kdl::importer::importer(unsigned concurrency, std::string cache_directory)
+    : m_concurrency(concurrency), m_cache_directory(cache_directory)
+{
+    if (m_concurrency == 0) {
+        m_concurrency = std::max(1U, std::thread::hardware_concurrency());
+    }
+}
+
+// MARK: - Import Graph
+
+void kdl::importer::run(kdl::source_manager::file_id root, kdk::target& target)
+{
+    auto& sources = kdl::source_manager::shared();
+    
+    m_units.clear();
+    m_canonical_paths.clear();
+    
+    auto root_path = sources.path(root);
+    char resolved[PATH_MAX];
+    m_canonical_paths.emplace(realpath(root_path.c_str(), resolved) ? std::string(resolved) : root_path, 0);
+    m_units.emplace_back();
+    m_units.back().file = root;
+    
+    // Parse the graph a level at a time. A level made up of a single file, such as the root,
+    // gets all of the threads to itself. Otherwise each thread parses whole files.
+    std::vector<std::size_t> level { 0 };
+    while (!level.empty()) {
+        if (level.size() == 1 || m_concurrency == 1) {
+            for (auto n : level) {
+                parse(m_units[n], m_concurrency);
+            }
+        }
+        else {
+            // Errors are captured by each worker, and only reported once all of them have
+            // finished.
+            std::atomic<std::size_t> next { 0 };
+            std::vector<std::thread> workers;
+            std::vector<std::vector<log::diagnostic>> diagnostics(level.size());
+            auto count = std::min<std::size_t>(m_concurrency, level.size());
+            
+            for (std::size_t i = 0; i < count; ++i) {
+                workers.emplace_back([this, &level, &next, &diagnostics] {
+                    for (auto n = next++; n < level.size(); n = next++) {
+                        log::capture capture;
+                        try {
+                            parse(m_units[level[n]], 1);
+                        }
+                        catch (const log::capture::aborted&) {
+                            
+                        }
+                        diagnostics[n] = capture.take_diagnostics();
+                    }
+                });
+            }
+            
+            for (auto& worker : workers) {
+                worker.join();
+            }
+            
+            std::vector<log::diagnostic> reports;
+            for (const auto& unit_diagnostics : diagnostics) {
+                reports.insert(std::end(reports), std::begin(unit_diagnostics), std::end(unit_diagnostics));
+            }
+            log::report(reports);
+        }
+        
+        // Nothing is being parsed now, so it is safe to load the files that were imported.
+        std::vector<std::size_t> discovered;
+        for (auto n : level) {
+            for (const auto& path : m_units[n].imports) {
+                auto known = m_units.size();
+                auto dependency = resolve(path);
+                m_units[n].dependencies.push_back(dependency);
+                if (dependency == known) {
+                    discovered.push_back(dependency);
+                }
+            }
+        }
+        level = std::move(discovered);
+    }
+    
+    // Add the resources to the target depth first, so that each file follows the files
+    // that it imports. Every file is visited once, which also breaks any import cycles.
+    std::vector<bool> visited(m_units.size(), false);
+    std::vector<std::pair<std::size_t, std::size_t>> stack { { 0, 0 } };
+    visited[0] = true;
+    
+    while (!stack.empty()) {
+        auto& top = stack.back();
+        const auto& u = m_units[top.first];
+        
+        if (top.second < u.dependencies.size()) {
+            auto dependency = u.dependencies[top.second++];
+            if (!visited[dependency]) {
+                visited[dependency] = true;
+                stack.emplace_back(dependency, 0);
+            }
+            continue;
+        }
+        
+        target.merge(std::move(m_units[top.first].target));
+        stack.pop_back();
+    }
+    
+    // Constants may be used anywhere in the graph, regardless of which file defines them,
+    // so expressions that use them can only be folded now.
+    kdl::expression::fold(target);
+}
+
+std::size_t kdl::importer::resolve(const kdl::lexer::token& path)
+{
+    // Imports are relative to the directory of the file that imports them.
+    std::string name { path.text() };
+    if (name.empty() || name.front() != '/') {
+        const auto& importer_path = kdl::source_manager::shared().path(path.file_id());
+        auto slash = importer_path.find_last_of('/');
+        if (slash != std::string::npos) {
+            name = importer_path.substr(0, slash + 1) + name;
+        }
+    }
+    
+    char resolved[PATH_MAX];
+    if (!realpath(name.c_str(), resolved)) {
+        log::error(path.file_id(), path.offset(), "Unable to find the imported file '" + std::string(path.text()) + "'.");
+    }
+    
+    return unit_for(name, resolved);
+}
+
+std::size_t kdl::importer::unit_for(const std::string& path, const std::string& canonical_path)
+{
+    auto it = m_canonical_paths.find(canonical_path);
+    if (it != m_canonical_paths.end()) {
+        return it->second;
+    }
+    
+    auto n = m_units.size();
+    m_canonical_paths.emplace(canonical_path, n);
+    m_units.emplace_back();
+    m_units.back().file = kdl::source_manager::shared().load_file(path);
+    return n;
+}
+
+// MARK: - Parsing
+
+void kdl::importer::parse(unit& u, unsigned concurrency) const
+{
+    if (!m_cache_directory.empty() && kdl::cache(m_cache_directory).load(u.file, u.target, u.imports)) {
+        return;
+    }
+    
+    // When running on a single thread tokens are streamed directly in to the semantic
+    // analyser. Otherwise the source is lexed up front, and both lexing and parsing are
+    // spread across threads.
+    kdl::lexer lexer(u.file);
+    auto sema = (concurrency == 1)
+              ? kdl::sema(std::move(u.target), lexer)
+              : kdl::sema(std::move(u.target), lexer.analyze_parallel(concurrency));
+    sema.run_parallel(concurrency);
+    u.target = std::move(sema.target());
+    u.imports = sema.imports();
+    
+    if (!m_cache_directory.empty()) {
+        kdl::cache(m_cache_directory).store(u.file, u.target, u.imports);
+    }
+}
@@ -0,0 +1,109 @@
+/*
+* Copyright (c) 2019 Tom Hancocks
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "kdl/source_manager.hpp"
+#include "kdl/lexer.hpp"
+#include "structures/target.hpp"
+
+#if !defined(KDL_IMPORTER)
+#define KDL_IMPORTER
+
+namespace kdl
+{
+
+/**
+ * The importer follows the graph of files imported through `@import`, starting from a
+ * single root file, and parses every file in the graph in to a target.
+ *
+ * Each file is only ever parsed once, no matter how many times or by what path it is
+ * imported. The graph is walked a level at a time: all of the files that were discovered
+ * by the previous level are lexed and parsed concurrently, each in to a target of its own,
+ * and only once they are all finished are the files that they import loaded. Source files
+ * are never loaded while other files are being parsed.
+ *
+ * The resources of the files are then added to the target depth first, so that the
+ * resources of an imported file come before those of the file importing it, in the order
+ * that the files were imported.
+ */
+class importer
+{
+public:
+    /**
+     * Construct a new importer that parses files using up to the specified number of
+     * threads, and optionally caches the parsed model of each file in a directory.
+     *
+     * \param concurrency The number of threads to use. Passing 0 will use the number of
+     * hardware threads available.
+     * \param cache_directory The directory of the cache, or an empty string to parse
+     * every file from scratch.
+     */
+    importer(unsigned concurrency, std::string cache_directory);
+    
+    /**
+     * Parse the specified file, along with every file that it imports, in to the target.
+     * Once every file is parsed, the expressions in the target are folded.
+     */
+    void run(kdl::source_manager::file_id root, kdk::target& target);
+    
+private:
+    /**
+     * A single file in the import graph.
+     */
+    struct unit
+    {
+        kdl::source_manager::file_id file { kdl::source_manager::invalid_file };
+        kdk::target target { "" };
+        std::vector<kdl::lexer::token> imports;
+        std::vector<std::size_t> dependencies;
+    };
+    
+    /**
+     * Lex and parse a single file in to the target of its unit, using up to the specified
+     * number of threads.
+     */
+    void parse(unit& u, unsigned concurrency) const;
+    
+    /**
+     * Returns the index of the unit for the file imported by the specified token, adding
+     * a new unit if the file has not been seen before.
+     */
+    std::size_t resolve(const kdl::lexer::token& path);
+    
+    /**
+     * Returns the index of the unit for the specified file, adding a new unit if the
+     * file has not been seen before.
+     */
+    std::size_t unit_for(const std::string& path, const std::string& canonical_path);
+    
+private:
+    unsigned m_concurrency;
+    std::string m_cache_directory;
+    std::vector<unit> m_units;
+    std::unordered_map<std::string, std::size_t> m_canonical_paths;
+};
+
+};
+
+#endif
@@ -21,341 +21,538 @@
 */
 
 #include "kdl/lexer.hpp"
-#include <stdexcept>
+#include "kdl/scanner.hpp"
 #include <algorithm>
-#include <fstream>
-#include <streambuf>
-#include <iostream>
+#include <charconv>
+#include <cstring>
+#include <thread>
 #include "diagnostic/log.hpp"
 
 // MARK: - Token
 
 kdl::lexer::token::token()
-    : m_line(0), m_offset(0), m_text("-"), m_type(unknown)
 {
     
 }
 
-kdl::lexer::token::token(const std::string file, const int line, const int offset, const std::string text, kdl::lexer::token::type type)
-    : m_file(file), m_line(line), m_offset(offset), m_text(text), m_type(type)
+kdl::lexer::token::token(kdl::source_manager::file_id file, const uint32_t offset, const uint32_t length, kdl::lexer::token::type type)
+    : m_offset(offset), m_length(length), m_file(file), m_type(type)
 {
     
 }
 
 // MARK: - Token Accessors
 
-std::string kdl::lexer::token::file() const
+const std::string& kdl::lexer::token::file() const
 {
-    return m_file;
+    static const std::string unknown_file { "<unknown>" };
+    if (m_file == kdl::source_manager::invalid_file) {
+        return unknown_file;
+    }
+    return kdl::source_manager::shared().path(m_file);
 }
 
-int kdl::lexer::token::line() const
+kdl::source_manager::file_id kdl::lexer::token::file_id() const
 {
-    return m_line + 1;
+    return m_file;
 }
 
-int kdl::lexer::token::offset() const
+uint32_t kdl::lexer::token::offset() const
 {
     return m_offset;
 }
 
-std::string kdl::lexer::token::text() const
+uint32_t kdl::lexer::token::length() const
 {
-    return m_text;
+    return m_length;
 }
 
-// MARK: - Token Operations
+uint32_t kdl::lexer::token::lexeme_begin() const
+{
+    if (m_type == directive || m_type == string || m_type == resource_id) {
+        return m_offset - 1;
+    }
+    return m_offset;
+}
 
-bool kdl::lexer::token::is_a(kdl::lexer::token::type type) const
+uint32_t kdl::lexer::token::lexeme_end() const
 {
-    return (m_type == type);
+    if (m_type == string || m_type == percentage) {
+        return m_offset + m_length + 1;
+    }
+    return m_offset + m_length;
 }
 
-// MARK: - Lexer Constructor
+int64_t kdl::lexer::token::value() const
+{
+    return m_value;
+}
 
-kdl::lexer::lexer(const std::string path, const std::string& content)
-    : m_path(path), m_source(content + "\n"), m_pos(0), m_length(content.length() + 1)
+kdk::atom kdl::lexer::token::atom() const
 {
-    
+    return kdk::atom::with_id(static_cast<uint32_t>(m_value));
 }
 
-kdl::lexer kdl::lexer::open_file(const std::string path)
+std::string_view kdl::lexer::token::text() const
 {
-    std::ifstream f(path);
-    std::string str;
+    if (m_file == kdl::source_manager::invalid_file) {
+        return "-";
+    }
+    return kdl::source_manager::shared().contents(m_file).substr(m_offset, m_length);
+}
 
-    f.seekg(0, std::ios::end);
-    str.reserve(f.tellg());
-    f.seekg(0, std::ios::beg);
+// MARK: - Token Operations
 
-    str.assign((std::istreambuf_iterator<char>(f)),
-                std::istreambuf_iterator<char>());
-    
-    return kdl::lexer(path, str);
+void kdl::lexer::token::relocate(int64_t offset_delta)
+{
+    m_offset = static_cast<uint32_t>(static_cast<int64_t>(m_offset) + offset_delta);
 }
 
-// MARK: - Lexical Analysis
+// MARK: - Character Classes
 
-std::vector<kdl::lexer::token> kdl::lexer::analyze()
+namespace
 {
-    while (available()) {
-        
-        // Consume any leading (nonbreaking) whitespace.
-        consume_while(set<' ', '\t'>::contains);
-        
-        // Check if we're looking at a new line character. If we are then simply consume it, and
-        // increment the current line number.
-        if (test_if(match<'\n'>::yes)) {
-            advance();
-            m_line++;
-            continue;
-        }
-        
-        // Check for a comment. If we're looking at a comment then we need to consume the entire
-        // line. We need to advance past the character at the end of the match.
-        if (test_if(match<'`'>::yes)) {
-            consume_while(match<'\n'>::no);
-        }
-        
-        // Constructs
-        else if (test_if(match<'@'>::yes)) {
-            // We're looking at a directive.
-            // Directive's are defined in the form of `@name`, an '@' followed by an identifier.
-            advance();
-            consume_while(identifier_set::contains);
-            
-            m_tokens.push_back(kdl::lexer::token(m_path, m_line, 0, m_slice, token::type::directive));
-        }
-        
-        // Literals
-        else if (test_if(match<'"'>::yes)) {
-            // We're looking at a string literal.
-            // The string continues until a corresponding '"' is found.
-            advance();
-            consume_while(match<'"'>::no);
-            m_tokens.push_back(kdl::lexer::token(m_path, m_line, 0, m_slice, token::type::string));
-            advance();
-        }
-        else if (test_if(match<'#'>::yes)) {
-            // We're looking at the beginning of a resource id literal.
-            // These take the form of #128, #129, etc.
-            advance();
-            consume_while(number_set::contains);
-            m_tokens.push_back(kdl::lexer::token(m_path, m_line, 0, m_slice, token::type::resource_id));
-        }
-        else if (test_if(number_set::contains)) {
-            // We're looking at a number, slice it out of the source, and then check the following
-            // character.
-            consume_while(number_set::contains);
-            auto number_text = m_slice;
-            
-            if (test_if(match<'%'>::yes)) {
-                // This is a percentage.
-                advance();
-                m_tokens.push_back(kdl::lexer::token(m_path, m_line, 0, number_text, token::type::percentage));
-            }
-            else {
-                m_tokens.push_back(kdl::lexer::token(m_path, m_line, 0, number_text, token::type::integer));
-            }
-        }
-        else if (test_if(identifier_set::contains)) {
-            // We're looking at an identifier. Extract the identifier and determine if it is a keyword.
-            consume_while(identifier_set::contains);
-            auto text = m_slice;
-            
-            // TODO: Check for keywords
-            
-            m_tokens.push_back(kdl::lexer::token(m_path, m_line, 0, text, token::type::identifier));
-        }
+
+/**
+ * Denotes the lexical class of a single source character. Every byte of the
+ * source is mapped to exactly one class, which is then used to drive the
+ * scanner's state machine.
+ */
+enum char_class : uint8_t
+{
+    invalid, whitespace, comment, directive, quote, hash,
+    digit, alpha, percent, symbol
+};
+
+/**
+ * The character class table used by the scanner. This is built at compile time
+ * so that classifying a character is a single indexed load. Single character
+ * symbols additionally map directly to the type of token they produce.
+ */
+struct char_class_table
+{
+    char_class cls[256];
+    kdl::lexer::token::type symbols[256];
+    
+    constexpr char_class_table()
+        : cls(), symbols()
+    {
+        cls[static_cast<uint8_t>(' ')] = whitespace;
+        cls[static_cast<uint8_t>('\t')] = whitespace;
+        cls[static_cast<uint8_t>('\r')] = whitespace;
+        cls[static_cast<uint8_t>('\n')] = whitespace;
+        cls[static_cast<uint8_t>('`')] = comment;
+        cls[static_cast<uint8_t>('@')] = directive;
+        cls[static_cast<uint8_t>('"')] = quote;
+        cls[static_cast<uint8_t>('#')] = hash;
+        cls[static_cast<uint8_t>('%')] = percent;
+        cls[static_cast<uint8_t>('_')] = alpha;
         
-        // Symbols
-        else if (test_if(match<';'>::yes)) {
-            m_tokens.push_back(kdl::lexer::token(m_path, m_line, 0, read(), token::type::semi_colon));
-        }
-        else if (test_if(match<'{'>::yes)) {
-            m_tokens.push_back(kdl::lexer::token(m_path, m_line, 0, read(), token::type::lbrace));
-        }
-        else if (test_if(match<'}'>::yes)) {
-            m_tokens.push_back(kdl::lexer::token(m_path, m_line, 0, read(), token::type::rbrace));
-        }
-        else if (test_if(match<'['>::yes)) {
-            m_tokens.push_back(kdl::lexer::token(m_path, m_line, 0, read(), token::type::lbracket));
-        }
-        else if (test_if(match<']'>::yes)) {
-            m_tokens.push_back(kdl::lexer::token(m_path, m_line, 0, read(), token::type::rbracket));
-        }
-        else if (test_if(match<'('>::yes)) {
-            m_tokens.push_back(kdl::lexer::token(m_path, m_line, 0, read(), token::type::lparen));
-        }
-        else if (test_if(match<')'>::yes)) {
-            m_tokens.push_back(kdl::lexer::token(m_path, m_line, 0, read(), token::type::rparen));
-        }
-        else if (test_if(match<'<'>::yes)) {
-            m_tokens.push_back(kdl::lexer::token(m_path, m_line, 0, read(), token::type::langle));
-        }
-        else if (test_if(match<'>'>::yes)) {
-            m_tokens.push_back(kdl::lexer::token(m_path, m_line, 0, read(), token::type::rangle));
-        }
-        else if (test_if(match<'='>::yes)) {
-            m_tokens.push_back(kdl::lexer::token(m_path, m_line, 0, read(), token::type::equals));
-        }
-        else if (test_if(match<'+'>::yes)) {
-            m_tokens.push_back(kdl::lexer::token(m_path, m_line, 0, read(), token::type::plus));
+        for (auto c = '0'; c <= '9'; ++c) {
+            cls[static_cast<uint8_t>(c)] = digit;
         }
-        else if (test_if(match<'-'>::yes)) {
-            m_tokens.push_back(kdl::lexer::token(m_path, m_line, 0, read(), token::type::minus));
+        for (auto c = 'a'; c <= 'z'; ++c) {
+            cls[static_cast<uint8_t>(c)] = alpha;
         }
-        else if (test_if(match<'*'>::yes)) {
-            m_tokens.push_back(kdl::lexer::token(m_path, m_line, 0, read(), token::type::star));
-        }
-        else if (test_if(match<'/'>::yes)) {
-            m_tokens.push_back(kdl::lexer::token(m_path, m_line, 0, read(), token::type::slash));
-        }
-        else if (test_if(match<':'>::yes)) {
-            m_tokens.push_back(kdl::lexer::token(m_path, m_line, 0, read(), token::type::colon));
-        }
-        else if (test_if(match<','>::yes)) {
-            m_tokens.push_back(kdl::lexer::token(m_path, m_line, 0, read(), token::type::comma));
-        }
-        else if (test_if(match<'.'>::yes)) {
-            m_tokens.push_back(kdl::lexer::token(m_path, m_line, 0, read(), token::type::dot));
-        }
-        else if (test_if(match<'&'>::yes)) {
-            m_tokens.push_back(kdl::lexer::token(m_path, m_line, 0, read(), token::type::ampersand));
-        }
-        else if (test_if(match<'|'>::yes)) {
-            m_tokens.push_back(kdl::lexer::token(m_path, m_line, 0, read(), token::type::pipe));
-        }
-        else if (test_if(match<'^'>::yes)) {
-            m_tokens.push_back(kdl::lexer::token(m_path, m_line, 0, read(), token::type::caret));
+        for (auto c = 'A'; c <= 'Z'; ++c) {
+            cls[static_cast<uint8_t>(c)] = alpha;
         }
         
-        // Error States
-        else {
-            log::error(m_path, m_line, "Unrecognised character '" + peek() + "' encountered.");
-        }
+        add_symbol(';', kdl::lexer::token::type::semi_colon);
+        add_symbol('{', kdl::lexer::token::type::lbrace);
+        add_symbol('}', kdl::lexer::token::type::rbrace);
+        add_symbol('[', kdl::lexer::token::type::lbracket);
+        add_symbol(']', kdl::lexer::token::type::rbracket);
+        add_symbol('(', kdl::lexer::token::type::lparen);
+        add_symbol(')', kdl::lexer::token::type::rparen);
+        add_symbol('<', kdl::lexer::token::type::langle);
+        add_symbol('>', kdl::lexer::token::type::rangle);
+        add_symbol('=', kdl::lexer::token::type::equals);
+        add_symbol('+', kdl::lexer::token::type::plus);
+        add_symbol('-', kdl::lexer::token::type::minus);
+        add_symbol('*', kdl::lexer::token::type::star);
+        add_symbol('/', kdl::lexer::token::type::slash);
+        add_symbol(':', kdl::lexer::token::type::colon);
+        add_symbol(',', kdl::lexer::token::type::comma);
+        add_symbol('.', kdl::lexer::token::type::dot);
+        add_symbol('&', kdl::lexer::token::type::ampersand);
+        add_symbol('|', kdl::lexer::token::type::pipe);
+        add_symbol('^', kdl::lexer::token::type::caret);
     }
     
-    return m_tokens;
-}
+    constexpr void add_symbol(char c, kdl::lexer::token::type type)
+    {
+        cls[static_cast<uint8_t>(c)] = symbol;
+        symbols[static_cast<uint8_t>(c)] = type;
+    }
+};
 
-// MARK: - Lexer Accessors
+constexpr char_class_table table;
 
-bool kdl::lexer::available(long offset, std::string::size_type size) const
+inline char_class class_of(char c)
 {
-    auto start = m_pos + offset;
-    auto end = start + size;
-    return (end <= m_length);
+    return table.cls[static_cast<uint8_t>(c)];
 }
 
+// MARK: - Keywords
 
-// MARK: - Lexer Operations
-
-void kdl::lexer::advance(long offset)
+struct keyword
+{
+    const char *text { nullptr };
+    std::size_t length { 0 };
+    kdl::lexer::token::type type { kdl::lexer::token::type::unknown };
+};
+
+constexpr keyword keywords[] = {
+    { "declare", 7, kdl::lexer::token::type::keyword_declare },
+    { "new", 3, kdl::lexer::token::type::keyword_new },
+    { "file", 4, kdl::lexer::token::type::keyword_file },
+    { "rgb", 3, kdl::lexer::token::type::keyword_rgb },
+    { "id", 2, kdl::lexer::token::type::keyword_id },
+    { "name", 4, kdl::lexer::token::type::keyword_name },
+};
+
+/**
+ * A perfect hash over the keyword set, derived from the first and last characters
+ * and the length of the word. Any change to the keyword set must keep this free of
+ * collisions, which is verified at compile time below.
+ */
+constexpr std::size_t keyword_hash(const char *text, std::size_t length)
 {
-    m_pos += offset;
+    return (static_cast<uint8_t>(text[0]) + 2 * static_cast<uint8_t>(text[length - 1]) + length) & 15;
 }
 
-std::string kdl::lexer::peek(long offset, std::string::size_type size) const
+struct keyword_table
 {
-    if (!available(offset, size)) {
-        log::error(m_path, m_line, "Failed to peek character from source.");
+    keyword slots[16];
+    
+    constexpr keyword_table()
+        : slots()
+    {
+        for (const auto& kw : keywords) {
+            slots[keyword_hash(kw.text, kw.length)] = kw;
+        }
     }
     
-    return m_source.substr(m_pos + offset, size);
-}
+    constexpr bool is_perfect() const
+    {
+        for (const auto& kw : keywords) {
+            if (slots[keyword_hash(kw.text, kw.length)].type != kw.type) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+constexpr keyword_table keyword_lookup;
 
-std::string kdl::lexer::read(long offset, std::string::size_type size)
+static_assert(keyword_lookup.is_perfect(), "The keyword hash has collisions. Adjust keyword_hash.");
+
+/**
+ * Returns the token type for the specified word, which will be either a keyword
+ * or a plain identifier.
+ */
+inline kdl::lexer::token::type classify_word(const char *start, std::size_t length)
 {
-    auto s = peek(offset, size);
-    advance(offset + size);
-    return s;
+    const auto& slot = keyword_lookup.slots[keyword_hash(start, length)];
+    if (slot.length == length && std::memcmp(slot.text, start, length) == 0) {
+        return slot.type;
+    }
+    return kdl::lexer::token::type::identifier;
 }
 
-// MARK: - Test / Validation
+};
 
-bool kdl::lexer::test_if(std::function<bool(const std::string)> testFn, long offset, std::string::size_type size) const
+// MARK: - Lexer Constructor
+
+kdl::lexer::lexer(const std::string path, std::string content)
+    : lexer(kdl::source_manager::shared().add_source(path, std::move(content)))
 {
-    auto chunk = peek(offset, size);
-    return testFn(chunk);
+    
 }
 
-bool kdl::lexer::consume_while(std::function<bool(const std::string)> testFn)
+kdl::lexer::lexer(kdl::source_manager::file_id file)
+    : m_file(file), m_source(kdl::source_manager::shared().contents(file))
 {
-    m_slice = "";
-    while (testFn(peek())) {
-        m_slice += read();
-    }
-    return !m_slice.empty();
+    m_ptr = m_source.data();
+    m_end = m_source.data() + m_source.size();
 }
 
-template <char c>
-bool kdl::match<c>::yes(const std::string __Chk)
+kdl::lexer::lexer(kdl::source_manager::file_id file, const char *begin, const char *end, bool speculative)
+    : m_file(file), m_source(kdl::source_manager::shared().contents(file)), m_speculative(speculative)
 {
-    return __Chk == std::string(1, c);
+    m_ptr = begin;
+    m_end = end;
 }
 
-template <char c>
-bool kdl::match<c>::no(const std::string __Chk)
+kdl::lexer::lexer(kdl::source_manager::file_id file, uint32_t offset)
+    : lexer(file)
 {
-    return !yes(__Chk);
+    m_ptr = m_source.data() + offset;
 }
 
-template <char lc, char uc>
-bool kdl::range<lc, uc>::contains(const std::string __Chk)
+kdl::lexer kdl::lexer::open_file(const std::string path)
 {
-    for (auto __ch : __Chk) {
-        if (__ch < lc || __ch > uc) {
-            return false;
-        }
+    return kdl::lexer(kdl::source_manager::shared().load_file(path));
+}
+
+// MARK: - Lexical Analysis
+
+std::vector<kdl::lexer::token> kdl::lexer::analyze()
+{
+    m_ptr = m_source.data();
+    
+    std::vector<kdl::lexer::token> tokens;
+    kdl::lexer::token tk;
+    while (next(tk)) {
+        tokens.push_back(tk);
     }
-    return true;
+    return tokens;
 }
 
-template <char lc, char uc>
-bool kdl::range<lc, uc>::not_contains(const std::string __Chk)
+bool kdl::lexer::next(kdl::lexer::token& tk)
 {
-    return !contains(__Chk);
+    while (m_ptr < m_end) {
+        auto start = m_ptr;
+        
+        switch (class_of(*m_ptr)) {
+            case whitespace: {
+                // Consume any leading whitespace. Tokens only record their offset, so new
+                // lines do not need to be counted.
+                m_ptr = kdl::scanner::whitespace_run(m_ptr + 1, m_end);
+                break;
+            }
+                
+            case comment: {
+                // Comments run to the end of the line.
+                m_ptr = kdl::scanner::find(m_ptr + 1, m_end, '\n');
+                break;
+            }
+                
+            case directive: {
+                // Directive's are defined in the form of `@name`, an '@' followed by an identifier.
+                m_ptr = kdl::scanner::identifier_run(start + 1, m_end);
+                tk = make_token(start + 1, m_ptr, token::type::directive);
+                tk.m_value = kdk::atom(std::string_view(start + 1, m_ptr - start - 1)).id();
+                return true;
+            }
+                
+            case quote: {
+                // The string continues until a corresponding '"' is found. Strings are allowed
+                // to span multiple lines.
+                m_ptr = kdl::scanner::find(start + 1, m_end, '"');
+                if (m_ptr >= m_end) {
+                    return fail(start, true, "Unterminated string literal encountered.");
+                }
+                tk = make_token(start + 1, m_ptr, token::type::string);
+                m_ptr++;
+                return true;
+            }
+                
+            case hash: {
+                // These take the form of #128, #129, #0x80, etc.
+                m_ptr = scan_number(start + 1);
+                tk = make_token(start + 1, m_ptr, token::type::resource_id);
+                if (!decode_number(tk)) {
+                    return fail(start, false, "Malformed or out of range resource id '" + std::string(start, m_ptr) + "' encountered.");
+                }
+                return true;
+            }
+                
+            case digit: {
+                // Check the character following the number to determine if this is a
+                // percentage or a plain integer.
+                m_ptr = scan_number(start);
+                if (m_ptr < m_end && class_of(*m_ptr) == percent) {
+                    tk = make_token(start, m_ptr, token::type::percentage);
+                    m_ptr++;
+                }
+                else {
+                    tk = make_token(start, m_ptr, token::type::integer);
+                }
+                
+                if (!decode_number(tk)) {
+                    return fail(start, false, "Malformed or out of range integer '" + std::string(start, m_ptr) + "' encountered.");
+                }
+                return true;
+            }
+                
+            case alpha: {
+                m_ptr = kdl::scanner::identifier_run(start + 1, m_end);
+                tk = make_token(start, m_ptr, classify_word(start, m_ptr - start));
+                tk.m_value = kdk::atom(std::string_view(start, m_ptr - start)).id();
+                return true;
+            }
+                
+            case symbol: {
+                m_ptr++;
+                tk = make_token(start, m_ptr, table.symbols[static_cast<uint8_t>(*start)]);
+                return true;
+            }
+                
+            case percent:
+            case invalid: {
+                return fail(start, false, "Unrecognised character '" + std::string(1, *m_ptr) + "' encountered.");
+            }
+        }
+    }
+    
+    return false;
 }
 
-template<char tC, char... ttC>
-bool kdl::set<tC, ttC...>::contains(const std::string __Chk)
+// MARK: - Parallel Lexical Analysis
+
+std::vector<kdl::lexer::token> kdl::lexer::analyze_parallel(unsigned concurrency)
 {
-    std::vector<char> v = {tC, ttC...};
+    if (concurrency == 0) {
+        concurrency = std::max(1U, std::thread::hardware_concurrency());
+    }
+    
+    auto begin = m_source.data();
+    auto end = m_source.data() + m_source.size();
+    auto chunk_size = std::max(m_source.size() / concurrency, minimum_chunk_size);
+    
+    if (concurrency == 1 || m_source.size() < chunk_size * 2) {
+        return analyze();
+    }
     
-    for (auto __ch : __Chk) {
-        if (std::find(v.begin(), v.end(), __ch) == v.end()) {
-            return false;
+    // Determine the boundaries of each chunk. Every chunk other than the first begins
+    // immediately after a new line, so that no token (other than a string literal) can
+    // straddle two chunks.
+    std::vector<const char *> bounds { begin };
+    while (static_cast<std::size_t>(end - bounds.back()) > chunk_size) {
+        auto nl = static_cast<const char *>(std::memchr(bounds.back() + chunk_size, '\n', end - bounds.back() - chunk_size));
+        if (!nl || nl + 1 >= end) {
+            break;
+        }
+        bounds.push_back(nl + 1);
+    }
+    bounds.push_back(end);
+    
+    // Lex each of the chunks speculatively, assuming that each one begins outside of a
+    // string literal. Tokens record offsets from the start of the source, so they need no
+    // adjustment once the chunks are stitched together.
+    struct chunk
+    {
+        std::vector<kdl::lexer::token> tokens;
+        const char *stall { nullptr };
+    };
+    
+    auto chunk_count = bounds.size() - 1;
+    std::vector<chunk> chunks(chunk_count);
+    std::vector<std::thread> workers;
+    
+    for (std::size_t i = 0; i < chunk_count; ++i) {
+        workers.emplace_back([this, i, &bounds, &chunks] {
+            auto& c = chunks[i];
+            c.tokens.reserve((bounds[i + 1] - bounds[i]) / 4);
+            
+            kdl::lexer lx(m_file, bounds[i], bounds[i + 1], true);
+            kdl::lexer::token tk;
+            while (lx.next(tk)) {
+                c.tokens.push_back(tk);
+            }
+            c.stall = lx.m_stall;
+        });
+    }
+    
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    
+    // Stitch the chunks back together. The cursor marks the point up to which the
+    // token stream is known to be correct. If a chunk did not start at the cursor,
+    // because the previous chunk ended inside of a string literal, then it is re-lexed
+    // from the cursor.
+    std::size_t total = 0;
+    for (auto& c : chunks) {
+        total += c.tokens.size();
+    }
+    
+    std::vector<kdl::lexer::token> tokens;
+    tokens.reserve(total);
+    
+    auto cursor = begin;
+    
+    for (std::size_t i = 0; i < chunk_count; ++i) {
+        auto& c = chunks[i];
+        
+        if (cursor == bounds[i] && !c.stall) {
+            tokens.insert(std::end(tokens), std::begin(c.tokens), std::end(c.tokens));
+            cursor = bounds[i + 1];
+        }
+        else {
+            kdl::lexer lx(m_file, cursor, bounds[i + 1], true);
+            kdl::lexer::token tk;
+            while (lx.next(tk)) {
+                tokens.push_back(tk);
+            }
+            
+            if (lx.m_stall && lx.m_stall_in_string && i + 1 < chunk_count) {
+                // The string literal continues in to the next chunk. Resume from the start
+                // of it when handling the next chunk.
+                cursor = lx.m_stall;
+            }
+            else if (lx.m_stall) {
+                // This is a genuine error in the source.
+                lx.m_speculative = false;
+                lx.fail(lx.m_stall, lx.m_stall_in_string, lx.m_stall_message);
+            }
+            else {
+                cursor = bounds[i + 1];
+            }
         }
     }
     
-    return true;
+    return tokens;
 }
 
-template<char tC, char... ttC>
-bool kdl::set<tC, ttC...>::not_contains(const std::string __Chk)
+// MARK: - Errors
+
+bool kdl::lexer::fail(const char *ptr, bool in_string, const std::string message)
 {
-    return !contains(__Chk);
+    if (!m_speculative) {
+        log::error(m_file, static_cast<uint32_t>(ptr - m_source.data()), message);
+    }
+    
+    m_stall = ptr;
+    m_stall_in_string = in_string;
+    m_stall_message = message;
+    m_ptr = m_end;
+    return false;
 }
 
-bool kdl::identifier_set::contains(const std::string __Chk)
+// MARK: - Numeric Literals
+
+const char *kdl::lexer::scan_number(const char *ptr) const
 {
-    for (auto __ch : __Chk) {
-        auto condition = (__ch >= 'A' && __ch <= 'Z') || (__ch >= 'a' && __ch <= 'z') || __ch == '_';
-        if (!condition) {
-            return false;
-        }
+    if (m_end - ptr > 2 && ptr[0] == '0' && (ptr[1] == 'x' || ptr[1] == 'X')) {
+        return kdl::scanner::hex_digit_run(ptr + 2, m_end);
     }
-    return true;
+    return kdl::scanner::digit_run(ptr, m_end);
 }
 
-bool kdl::number_set::contains(const std::string __Chk)
+bool kdl::lexer::decode_number(kdl::lexer::token& tk) const
 {
-    for (auto __ch : __Chk) {
-        auto condition = (__ch >= '0' && __ch <= '9');
-        if (!condition) {
-            return false;
-        }
+    auto first = m_source.data() + tk.m_offset;
+    auto last = first + tk.m_length;
+    auto base = 10;
+    
+    if (tk.m_length > 2 && first[0] == '0' && (first[1] == 'x' || first[1] == 'X')) {
+        first += 2;
+        base = 16;
     }
-    return true;
+    
+    auto result = std::from_chars(first, last, tk.m_value, base);
+    return result.ec == std::errc() && result.ptr == last;
+}
+
+// MARK: - Token Construction
+
+kdl::lexer::token kdl::lexer::make_token(const char *start, const char *end, kdl::lexer::token::type type) const
+{
+    auto offset = static_cast<uint32_t>(start - m_source.data());
+    auto length = static_cast<uint32_t>(end - start);
+    return kdl::lexer::token(m_file, offset, length, type);
 }
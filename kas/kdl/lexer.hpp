@@ -21,9 +21,11 @@
 */
 
 #include <string>
+#include <string_view>
 #include <vector>
-#include <type_traits>
-#include <memory>
+#include <cstdint>
+#include "structures/atom.hpp"
+#include "kdl/source_manager.hpp"
 
 #if !defined(KDL_LEXER)
 #define KDL_LEXER
@@ -42,6 +44,9 @@ public:
     
     /**
      * Represents an individual token extracted from the raw textual content.
+     *
+     * Tokens do not own their text. Instead they refer to a span of the source
+     * buffer held by the `kdl::source_manager`, which outlives the token stream.
      */
     struct token
     {
@@ -50,12 +55,17 @@ public:
         /**
          * Denotes the type of information that a token is representing.
          */
-        enum type
+        enum type : uint8_t
         {
             unknown, identifier, resource_id, string, integer, percentage,
             lbrace, rbrace, lparen, rparen, langle, rangle, lbracket, rbracket,
             plus, minus, star, slash, pipe, ampersand, equals, colon, dot, comma,
-            caret, directive, semi_colon
+            caret, directive, semi_colon,
+            
+            // Keywords. These are recognised by the lexer, but remain valid anywhere
+            // an identifier is expected.
+            keyword_declare, keyword_new, keyword_file, keyword_rgb, keyword_id,
+            keyword_name
         };
         
     public:
@@ -65,49 +75,107 @@ public:
         token();
         
         /**
-         * Construct a new token.
+         * Construct a new token spanning the specified range of a source buffer.
          */
-        token(const std::string file, const int line, const int offset, const std::string text, token::type type);
+        token(kdl::source_manager::file_id file, const uint32_t offset, const uint32_t length, token::type type);
         
         /**
          * Returns the name of the file where the token was located.
          */
-        std::string file() const;
+        const std::string& file() const;
+        
+        /**
+         * Returns the id of the source buffer in which the token was located.
+         */
+        kdl::source_manager::file_id file_id() const;
+        
+        /**
+         * Returns the byte offset in the source buffer where the token started from. This
+         * is the only location information held by a token. The line and column can be
+         * recovered from it through `kdl::source_manager::locate`.
+         */
+        uint32_t offset() const;
+        
+        /**
+         * Returns the length of the token text in bytes.
+         */
+        uint32_t length() const;
+        
+        /**
+         * Returns the offset at which the source text of the token begins, including any
+         * leading sigil or quote that is not part of the token text.
+         */
+        uint32_t lexeme_begin() const;
+        
+        /**
+         * Returns the offset just beyond the source text of the token, including any
+         * trailing quote or percent sign that is not part of the token text.
+         */
+        uint32_t lexeme_end() const;
         
         /**
-         * Returns the line number of the original source file in which the token
-         * originated from.
+         * Returns the textual representation of the token. The returned view remains
+         * valid for the lifetime of the source manager.
          */
-        int line() const;
+        std::string_view text() const;
         
         /**
-         * Returns the offset in the line where the token started from.
+         * Returns the decoded value of an integer, percentage or resource id token.
+         * Numeric literals are decoded once, by the lexer.
          */
-        int offset() const;
+        int64_t value() const;
         
         /**
-         * Returns the textual representation of the token.
+         * Returns the interned text of an identifier, keyword or directive token. Words
+         * are interned once, by the lexer.
          */
-        std::string text() const;
+        kdk::atom atom() const;
         
         /**
-         * Test if the type of the token matches the specified type.
+         * Test if the type of the token matches the specified type. Keyword tokens
+         * are also considered to be identifiers.
          */
         bool is_a(token::type type) const;
         
+        /**
+         * Test if the token is a keyword.
+         */
+        bool is_keyword() const;
+        
+        /**
+         * Move the token by the specified number of bytes, to account for an edit made
+         * to the source text ahead of it.
+         */
+        void relocate(int64_t offset_delta);
+        
     private:
-        int m_line;
-        int m_offset;
-        std::string m_text;
-        token::type m_type;
-        std::string m_file;
+        friend class lexer;
+        
+        int64_t m_value { 0 };
+        uint32_t m_offset { 0 };
+        uint32_t m_length { 0 };
+        kdl::source_manager::file_id m_file { kdl::source_manager::invalid_file };
+        token::type m_type { unknown };
     };
     
 public:
     /**
-     * Construct a new lexical analyser using the source code provided.
+     * Construct a new lexical analyser using the source code provided. The source is
+     * handed to the shared `kdl::source_manager` to be owned for the rest of the compile.
+     */
+    lexer(const std::string path, std::string source);
+    
+    /**
+     * Construct a new lexical analyser over a source buffer already held by the
+     * shared `kdl::source_manager`.
+     */
+    lexer(kdl::source_manager::file_id file);
+    
+    /**
+     * Construct a new lexical analyser that starts part way through a source buffer held
+     * by the shared `kdl::source_manager`, at the specified byte offset.
      */
-    lexer(const std::string path, const std::string& source);
+    lexer(kdl::source_manager::file_id file, uint32_t offset);
     
     /**
      * Create a new lexer, using the contents of the specified file as the source.
@@ -129,118 +197,90 @@ public:
     std::vector<kdl::lexer::token> analyze();
     
     /**
-     * Test if there is any more characters in source to parse.
+     * Perform the lexical analysis across multiple threads.
+     *
+     * The source is split in to chunks at new line boundaries, and each chunk is
+     * lexed on its own worker thread. The results are then stitched back together in
+     * source order, re-lexing any chunk that began inside of a multi-line string
+     * literal. Small sources are simply lexed on the calling thread.
+     *
+     * \param concurrency The number of worker threads to use. Passing 0 will use
+     * the number of hardware threads available.
+     * \return A token stream of all tokens found.
      */
-    bool available(long offset = 0, std::string::size_type size = 1) const;
+    std::vector<kdl::lexer::token> analyze_parallel(unsigned concurrency = 0);
     
     /**
-     * Advance the lexer forward by the specified number of characters.
+     * Extract the next token from the source.
      *
-     * \note It is safe to advance forward beyond the end of the source with this method,
-     * as no content needs to be accessed.
+     * This allows tokens to be pulled from the source on demand, so that a consumer
+     * does not need to hold the entire token stream in memory.
+     *
+     * \return false when the end of the source has been reached.
      */
-    void advance(long offset = 1);
+    bool next(kdl::lexer::token& tk);
     
+private:
     /**
-     * Peek a string/character from the source.
-     *
-     * This peek happens at the specified offset for the specified number of characters.
-     * A check is performed to see if the peek is valid. If it is not an exception
-     * will be raised.
-     *
-     * This operation does not advance the internal pointer to the source.
+     * The smallest amount of source, in bytes, that is worth handing to a worker thread.
      */
-    std::string peek(long offset = 0, std::string::size_type size = 1) const;
+    static constexpr std::size_t minimum_chunk_size = 1 << 20;
     
     /**
-     * Read a string/character from the source.
-     *
-     * This read happens at the specified offset for the specified number of characters.
-     * A check is performed to see if the read is valid. If it is not an exception
-     * will be raised.
+     * Construct a lexer over a sub-range of a source buffer. A speculative lexer records
+     * where it was unable to continue, rather than reporting an error, as it may have
+     * been started at the wrong state.
+     */
+    lexer(kdl::source_manager::file_id file, const char *begin, const char *end, bool speculative);
+    
+    /**
+     * Stop lexing due to an error at the specified location. Non speculative lexers
+     * report the error immediately.
      *
-     * This operation does advance the internal pointer to the source.
+     * \return Always returns false, so that it can be returned from `next`.
      */
-    std::string read(long offset = 0, std::string::size_type size = 1);
+    bool fail(const char *ptr, bool in_string, const std::string message);
     
     /**
-     * Test if the content pointed to can be validated by the provided function.
+     * Returns the end of the numeric literal starting at the specified location. Both
+     * decimal and hexadecimal (0x prefixed) literals are accepted.
      */
-    bool test_if(std::function<bool(const std::string)> testFn, long offset = 0, std::string::size_type size = 1) const;
+    const char *scan_number(const char *ptr) const;
     
     /**
-     * Keep consuming characters whilst the test function evaluates true.
+     * Decode the value of a numeric token, checking that it fits in to 64 bits.
      *
-     * Upon completion the `m_slice` member will have been updated. If the function failed
-     * then m_slice will be empty, otherwise it will contain the matched content.
+     * \return false if the literal is empty, malformed or out of range.
      */
-    bool consume_while(std::function<bool(const std::string)> testFn);
+    bool decode_number(token& tk) const;
+    
+    /**
+     * Construct a new token, using the source text between the two specified pointers.
+     */
+    token make_token(const char *start, const char *end, token::type type) const;
     
 private:
-    int m_line;
-    std::string::size_type m_pos;
-    std::string::size_type m_length;
-    std::string m_source;
-    std::vector<token> m_tokens;
-    std::string m_slice;
-    std::string m_path;
+    const char *m_ptr { nullptr };
+    const char *m_end { nullptr };
+    kdl::source_manager::file_id m_file;
+    std::string_view m_source;
+    bool m_speculative { false };
+    const char *m_stall { nullptr };
+    bool m_stall_in_string { false };
+    std::string m_stall_message;
 };
 
-// MARK: - Test Functions
-
-/**
- * Template function for testing if a chunk matches the specified character.
- *
- * The `test_if` function of the kdl::lexer will pass a std::string reference to the template
- * function to be tested against the value given. This is only capable of testing single
- * characters, not entire strings.
- *
- * \example
- *  test_if(match<'='>::yes)
- */
-template <char c>
-struct match {
-    static bool yes(const std::string);
-    static bool no(const std::string);
-};
+// MARK: - Inline Token Operations
 
-template <char lC, char uC>
-struct range {
-    static bool contains(const std::string);
-    static bool not_contains(const std::string);
-};
-
-
-/**
- * Template function for testing if all characters of a chunk exist within a specified set
- * of characters.
- *
- * The `test_if` function of the kdl::lexer will pass a std::string reference to the template
- * function to be tested against the value given.
- *
- * \example
- *  test_if(set<' ', '\t'>::contains)
- */
-template<char tC, char... ttC>
-struct set {
-    static bool contains(const std::string);
-    static bool not_contains(const std::string);
-};
-
-/**
- * Specialised test function for testing identifier characters.
- */
-struct identifier_set {
-    static bool contains(const std::string);
-};
-
-/**
- * Specialised test function for testing number characters.
- */
-struct number_set {
-    static bool contains(const std::string);
-};
+inline bool lexer::token::is_a(lexer::token::type type) const
+{
+    return (m_type == type) || (type == identifier && is_keyword());
+}
 
+inline bool lexer::token::is_keyword() const
+{
+    return (m_type >= keyword_declare);
+}
 
 };
 
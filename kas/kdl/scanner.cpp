@@ -0,0 +1,286 @@
+/*
+* Copyright (c) 2019 Tom Hancocks
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <cstring>
+#include "kdl/scanner.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#   define KDL_SCANNER_X86 1
+#   include <immintrin.h>
+#endif
+
+namespace
+{
+
+// MARK: - Scalar Kernels
+
+template<bool(*Predicate)(char)>
+const char *scalar_run(const char *ptr, const char *end)
+{
+    while (ptr < end && Predicate(*ptr)) {
+        ++ptr;
+    }
+    return ptr;
+}
+
+/**
+ * Append the start of each line following a new line between ptr and end, as an offset
+ * from begin.
+ */
+void scalar_lines(const char *begin, const char *ptr, const char *end, std::vector<uint32_t>& starts)
+{
+    for (; ptr < end; ++ptr) {
+        if (*ptr == '\n') {
+            starts.push_back(static_cast<uint32_t>(ptr - begin + 1));
+        }
+    }
+}
+
+// MARK: - Character Classes
+
+/**
+ * Each character class provides a scalar test, and on x86 16 and 32 byte vector
+ * tests which set every byte lane that is a member of the class to 0xFF.
+ */
+struct whitespace_class
+{
+    static bool test(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
+    
+#if KDL_SCANNER_X86
+    static __m128i match16(__m128i v)
+    {
+        auto sp = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+        auto tab = _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'));
+        auto cr = _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'));
+        auto lf = _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'));
+        return _mm_or_si128(_mm_or_si128(sp, tab), _mm_or_si128(cr, lf));
+    }
+    
+    __attribute__((target("avx2")))
+    static __m256i match32(__m256i v)
+    {
+        auto sp = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+        auto tab = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'));
+        auto cr = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'));
+        auto lf = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'));
+        return _mm256_or_si256(_mm256_or_si256(sp, tab), _mm256_or_si256(cr, lf));
+    }
+#endif
+};
+
+struct digit_class
+{
+    static bool test(char c)
+    {
+        return static_cast<unsigned char>(c - '0') < 10;
+    }
+    
+#if KDL_SCANNER_X86
+    static __m128i match16(__m128i v)
+    {
+        // Bytes with the high bit set compare as negative, and so fall outside of the range.
+        auto lo = _mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1));
+        auto hi = _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1));
+        return _mm_and_si128(lo, hi);
+    }
+    
+    __attribute__((target("avx2")))
+    static __m256i match32(__m256i v)
+    {
+        auto lo = _mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1));
+        auto hi = _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v);
+        return _mm256_and_si256(lo, hi);
+    }
+#endif
+};
+
+struct identifier_class
+{
+    static bool test(char c)
+    {
+        return static_cast<unsigned char>((c | 0x20) - 'a') < 26 || c == '_';
+    }
+    
+#if KDL_SCANNER_X86
+    static __m128i match16(__m128i v)
+    {
+        // Folding to lower case allows a single range test to cover both cases.
+        auto lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+        auto lo = _mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1));
+        auto hi = _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1));
+        auto underscore = _mm_cmpeq_epi8(v, _mm_set1_epi8('_'));
+        return _mm_or_si128(_mm_and_si128(lo, hi), underscore);
+    }
+    
+    __attribute__((target("avx2")))
+    static __m256i match32(__m256i v)
+    {
+        auto lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+        auto lo = _mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1));
+        auto hi = _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower);
+        auto underscore = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_'));
+        return _mm256_or_si256(_mm256_and_si256(lo, hi), underscore);
+    }
+#endif
+};
+
+#if KDL_SCANNER_X86
+
+// MARK: - SSE2 Kernels
+
+template<typename Class>
+const char *sse2_run(const char *ptr, const char *end)
+{
+    while (end - ptr >= 16) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr));
+        auto mask = ~static_cast<unsigned>(_mm_movemask_epi8(Class::match16(v))) & 0xFFFFU;
+        if (mask) {
+            return ptr + __builtin_ctz(mask);
+        }
+        ptr += 16;
+    }
+    return scalar_run<Class::test>(ptr, end);
+}
+
+void sse2_lines(const char *begin, const char *ptr, const char *end, std::vector<uint32_t>& starts)
+{
+    auto nl = _mm_set1_epi8('\n');
+    while (end - ptr >= 16) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr));
+        auto mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)));
+        while (mask) {
+            starts.push_back(static_cast<uint32_t>(ptr - begin + __builtin_ctz(mask) + 1));
+            mask &= mask - 1;
+        }
+        ptr += 16;
+    }
+    scalar_lines(begin, ptr, end, starts);
+}
+
+// MARK: - AVX2 Kernels
+
+template<typename Class>
+__attribute__((target("avx2")))
+const char *avx2_run(const char *ptr, const char *end)
+{
+    while (end - ptr >= 32) {
+        auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ptr));
+        auto mask = ~static_cast<unsigned>(_mm256_movemask_epi8(Class::match32(v)));
+        if (mask) {
+            return ptr + __builtin_ctz(mask);
+        }
+        ptr += 32;
+    }
+    return sse2_run<Class>(ptr, end);
+}
+
+__attribute__((target("avx2")))
+void avx2_lines(const char *begin, const char *ptr, const char *end, std::vector<uint32_t>& starts)
+{
+    auto nl = _mm256_set1_epi8('\n');
+    while (end - ptr >= 32) {
+        auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ptr));
+        auto mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl)));
+        while (mask) {
+            starts.push_back(static_cast<uint32_t>(ptr - begin + __builtin_ctz(mask) + 1));
+            mask &= mask - 1;
+        }
+        ptr += 32;
+    }
+    sse2_lines(begin, ptr, end, starts);
+}
+
+#endif
+
+// MARK: - Dispatch
+
+typedef const char *(*run_kernel)(const char *, const char *);
+typedef void (*lines_kernel)(const char *, const char *, const char *, std::vector<uint32_t>&);
+
+struct kernel_table
+{
+    const char *isa;
+    run_kernel whitespace;
+    run_kernel digit;
+    run_kernel identifier;
+    lines_kernel lines;
+};
+
+kernel_table select_kernels()
+{
+#if KDL_SCANNER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return { "avx2", avx2_run<whitespace_class>, avx2_run<digit_class>, avx2_run<identifier_class>, avx2_lines };
+    }
+    return { "sse2", sse2_run<whitespace_class>, sse2_run<digit_class>, sse2_run<identifier_class>, sse2_lines };
+#else
+    return { "scalar", scalar_run<whitespace_class::test>, scalar_run<digit_class::test>, scalar_run<identifier_class::test>, scalar_lines };
+#endif
+}
+
+const kernel_table kernels = select_kernels();
+
+};
+
+// MARK: - Kernels
+
+const char *kdl::scanner::whitespace_kernel(const char *ptr, const char *end)
+{
+    return kernels.whitespace(ptr, end);
+}
+
+const char *kdl::scanner::digit_kernel(const char *ptr, const char *end)
+{
+    return kernels.digit(ptr, end);
+}
+
+const char *kdl::scanner::identifier_kernel(const char *ptr, const char *end)
+{
+    return kernels.identifier(ptr, end);
+}
+
+// MARK: - Scanning
+
+const char *kdl::scanner::find(const char *ptr, const char *end, char c)
+{
+    // The C library's memchr is already vectorised, and dispatched on CPU features, on
+    // all of the platforms that we target.
+    if (ptr >= end) {
+        return end;
+    }
+    auto found = std::memchr(ptr, c, static_cast<std::size_t>(end - ptr));
+    return found ? static_cast<const char *>(found) : end;
+}
+
+void kdl::scanner::line_starts(const char *begin, const char *end, std::vector<uint32_t>& starts)
+{
+    kernels.lines(begin, begin, end, starts);
+}
+
+const char *kdl::scanner::isa()
+{
+    return kernels.isa;
+}
@@ -0,0 +1,168 @@
+/*
+* Copyright (c) 2019 Tom Hancocks
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if !defined(KDL_SCANNER)
+#define KDL_SCANNER
+
+namespace kdl
+{
+
+/**
+ * The scanner provides the kernels used by the lexer to find the end of runs of
+ * characters, such as whitespace, identifiers, numbers, comments and the bodies
+ * of string literals, and by the source manager to find the start of each line.
+ *
+ * On x86 the kernels classify 16 (SSE2) or 32 (AVX2) bytes at a time, with the
+ * widest instruction set supported by the host CPU being selected at runtime.
+ * Other architectures use scalar implementations.
+ */
+struct scanner
+{
+public:
+    /**
+     * Returns a pointer to the first character that is not a space, tab, carriage
+     * return or new line, or `end` if the run continues to the end of the source.
+     */
+    static const char *whitespace_run(const char *ptr, const char *end);
+    
+    /**
+     * Returns a pointer to the first character that is not a decimal digit, or `end`
+     * if the run continues to the end of the source.
+     */
+    static const char *digit_run(const char *ptr, const char *end);
+    
+    /**
+     * Returns a pointer to the first character that is not a hexadecimal digit, or
+     * `end` if the run continues to the end of the source. Hexadecimal literals are
+     * rare, so this is always scalar.
+     */
+    static const char *hex_digit_run(const char *ptr, const char *end);
+    
+    /**
+     * Returns a pointer to the first character that is not a valid identifier
+     * character (A-Z, a-z, _), or `end` if the run continues to the end of the source.
+     */
+    static const char *identifier_run(const char *ptr, const char *end);
+    
+    /**
+     * Returns a pointer to the first occurrence of the specified character, or `end`
+     * if it does not occur.
+     */
+    static const char *find(const char *ptr, const char *end, char c);
+    
+    /**
+     * Append the offset, relative to `begin`, of the character following each new line
+     * between `begin` and `end` to the specified vector.
+     */
+    static void line_starts(const char *begin, const char *end, std::vector<uint32_t>& starts);
+    
+    /**
+     * Returns the name of the instruction set selected for the scanning kernels.
+     */
+    static const char *isa();
+    
+private:
+    /**
+     * Most runs in KDL source are only a handful of characters long, and are cheaper
+     * to finish with a scalar loop than to hand to a vector kernel. Only runs longer
+     * than this are handed over.
+     */
+    static constexpr long scalar_prefix = 16;
+    
+    static bool is_whitespace(char c);
+    static bool is_digit(char c);
+    static bool is_hex_digit(char c);
+    static bool is_identifier(char c);
+    
+    static const char *whitespace_kernel(const char *ptr, const char *end);
+    static const char *digit_kernel(const char *ptr, const char *end);
+    static const char *identifier_kernel(const char *ptr, const char *end);
+    
+    template<bool(*Predicate)(char), const char *(*Kernel)(const char *, const char *)>
+    static const char *run(const char *ptr, const char *end);
+};
+
+// MARK: - Inline Scanning
+
+inline bool scanner::is_whitespace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+inline bool scanner::is_digit(char c)
+{
+    return static_cast<unsigned char>(c - '0') < 10;
+}
+
+inline bool scanner::is_hex_digit(char c)
+{
+    return is_digit(c) || static_cast<unsigned char>((c | 0x20) - 'a') < 6;
+}
+
+inline bool scanner::is_identifier(char c)
+{
+    return static_cast<unsigned char>((c | 0x20) - 'a') < 26 || c == '_';
+}
+
+template<bool(*Predicate)(char), const char *(*Kernel)(const char *, const char *)>
+inline const char *scanner::run(const char *ptr, const char *end)
+{
+    auto limit = (end - ptr > scalar_prefix) ? ptr + scalar_prefix : end;
+    while (ptr < limit) {
+        if (!Predicate(*ptr)) {
+            return ptr;
+        }
+        ++ptr;
+    }
+    return (ptr < end) ? Kernel(ptr, end) : ptr;
+}
+
+inline const char *scanner::whitespace_run(const char *ptr, const char *end)
+{
+    return run<is_whitespace, whitespace_kernel>(ptr, end);
+}
+
+inline const char *scanner::digit_run(const char *ptr, const char *end)
+{
+    return run<is_digit, digit_kernel>(ptr, end);
+}
+
+inline const char *scanner::hex_digit_run(const char *ptr, const char *end)
+{
+    while (ptr < end && is_hex_digit(*ptr)) {
+        ++ptr;
+    }
+    return ptr;
+}
+
+inline const char *scanner::identifier_run(const char *ptr, const char *end)
+{
+    return run<is_identifier, identifier_kernel>(ptr, end);
+}
+
+};
+
+#endif
@@ -22,14 +22,48 @@
 
 #include "kdl/sema.hpp"
 #include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <atomic>
+#include <memory>
+#include <thread>
 #include "kdl/sema/directive.hpp"
 #include "kdl/sema/declaration.hpp"
 #include "diagnostic/log.hpp"
 
+// MARK: - Helpers
+
+namespace
+{
+
+/**
+ * Test if the token introduces an `@if` directive, which applies to the declaration that
+ * follows it.
+ */
+bool is_condition(const kdl::lexer::token& tk)
+{
+    static const kdk::atom condition { "if" };
+    return tk.is_a(kdl::lexer::token::type::directive) && tk.atom() == condition;
+}
+
+};
+
 // MARK: - Constructor
 
-kdl::sema::sema(kdk::target target, const std::vector<kdl::lexer::token> tokens)
-    : m_target(target), m_tokens(tokens), m_ptr(0)
+kdl::sema::sema(kdk::target target, std::vector<kdl::lexer::token> tokens)
+    : m_ptr(0), m_tokens(std::move(tokens)), m_view(m_tokens.data(), m_tokens.size()), m_target(std::move(target))
+{
+    
+}
+
+kdl::sema::sema(kdk::target target, kdk::span<const kdl::lexer::token> tokens)
+    : m_ptr(0), m_view(tokens), m_target(std::move(target))
+{
+    
+}
+
+kdl::sema::sema(kdk::target target, kdl::lexer& lexer)
+    : m_ptr(0), m_lexer(&lexer), m_target(std::move(target))
 {
     
 }
@@ -41,13 +75,37 @@ kdk::target& kdl::sema::target()
     return m_target;
 }
 
+void kdl::sema::add_import(const kdl::lexer::token& path)
+{
+    m_imports.push_back(path);
+}
+
+const std::vector<kdl::lexer::token>& kdl::sema::imports() const
+{
+    return m_imports;
+}
+
+void kdl::sema::set_condition(std::vector<kdk::atom> variants)
+{
+    m_condition = std::move(variants);
+}
+
+std::vector<kdk::atom> kdl::sema::take_condition()
+{
+    return std::move(m_condition);
+}
+
 // MARK: - Semantic Analysis
 
 void kdl::sema::run()
 {
     // Reset the iterator, in the event of running the semantic analysis twice we
-    // need to do this.
+    // need to do this. A lexer backed stream can not be rewound.
     m_ptr = 0;
+    m_head = 0;
+    m_count = 0;
+    m_imports.clear();
+    m_condition.clear();
     
     while (!finished()) {
         if (kdl::directive::test(this)) {
@@ -58,126 +116,215 @@ void kdl::sema::run()
         }
         else {
             auto token = peek();
-            log::error(token.file(), token.line(), "Unexpected token '" + token.text() + "' encountered");
+            log::error(token.file_id(), token.offset(), "Unexpected token '" + std::string(token.text()) + "' encountered");
         }
     }
 }
 
-// MARK: - Stream
-
-bool kdl::sema::finished(long offset, long count) const
-{
-    auto ptr = (m_ptr + offset);
-    auto end_ptr = ptr + count;
-    auto size = m_tokens.size();
-    return ptr > size || end_ptr > size;
-}
-
-void kdl::sema::advance(long delta)
-{
-    m_ptr += delta;
-}
-
-kdl::lexer::token kdl::sema::read(long offset)
-{
-    auto tk = peek(offset);
-    m_ptr += offset + 1;
-    return tk;
-}
-
-kdl::lexer::token kdl::sema::peek(long offset) const
+void kdl::sema::run_parallel(unsigned concurrency)
 {
-    if (finished(offset, 1)) {
-        throw std::runtime_error("Attempted to access token beyond end of token stream.");
+    if (concurrency == 0) {
+        concurrency = std::max(1U, std::thread::hardware_concurrency());
     }
     
-    return m_tokens[m_ptr + offset];
-}
-
-std::vector<kdl::lexer::token> kdl::sema::consume(kdl::condition::falsey_function f)
-{
-    std::vector<kdl::lexer::token> v;
+    if (m_lexer || concurrency == 1) {
+        run();
+        return;
+    }
+    
+    m_imports.clear();
     
-    while (!finished() && f(peek())) {
-        v.push_back(read());
+    // Prescan the token stream for the top level blocks. Each of these is independent of
+    // the others, and only declarations are safe to parse away from the calling thread.
+    struct unit
+    {
+        std::size_t first { 0 };
+        std::size_t count { 0 };
+        bool declaration { false };
+        kdk::target target { "" };
+        std::vector<kdl::lexer::token> imports;
+        std::vector<log::diagnostic> diagnostics;
+    };
+    
+    std::vector<unit> units;
+    for (std::size_t first = 0; first < m_view.size(); ) {
+        unit u;
+        auto closed = false;
+        u.first = first;
+        u.count = measure_block(m_view, first, closed);
+        u.declaration = closed && (m_view[first].is_a(kdl::lexer::token::type::keyword_declare) || is_condition(m_view[first]));
+        first += u.count;
+        units.push_back(std::move(u));
     }
     
-    return v;
-}
-
-// MARK: - Conditions / Expectations
-
-bool kdl::sema::expect(kdl::condition::truthy_function f) const
-{
-    return !finished() && f(peek());
+    // Parse each of the units with a semantic analyser of its own. Every worker has its
+    // own arena, as arenas are not safe to share between threads. The tokens of the unit
+    // are parsed in place rather than copied. Errors are captured rather than reported, as
+    // the program can not safely be terminated whilst other workers are still running.
+    auto parse = [this] (unit& u, std::shared_ptr<kdk::arena> arena) {
+        log::capture capture;
+        try {
+            kdl::sema sema(kdk::target("", arena), kdk::span<const kdl::lexer::token>(m_view.data() + u.first, u.count));
+            sema.run();
+            u.target = std::move(sema.target());
+            u.imports = sema.imports();
+        }
+        catch (const log::capture::aborted&) {
+            
+        }
+        u.diagnostics = capture.take_diagnostics();
+    };
+    
+    std::atomic<std::size_t> next { 0 };
+    std::vector<std::shared_ptr<kdk::arena>> arenas;
+    std::vector<std::thread> workers;
+    
+    for (unsigned i = 0; i < concurrency; ++i) {
+        arenas.push_back(std::make_shared<kdk::arena>());
+        workers.emplace_back([&units, &next, &parse, arena = arenas.back()] {
+            for (auto n = next++; n < units.size(); n = next++) {
+                if (units[n].declaration) {
+                    parse(units[n], arena);
+                }
+            }
+        });
+    }
+    
+    auto arena = std::make_shared<kdk::arena>();
+    for (auto& u : units) {
+        if (!u.declaration) {
+            parse(u, arena);
+        }
+    }
+    
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    
+    // Every worker has finished, so any errors can now be reported, in source order.
+    std::vector<log::diagnostic> diagnostics;
+    for (auto& u : units) {
+        diagnostics.insert(std::end(diagnostics), std::begin(u.diagnostics), std::end(u.diagnostics));
+    }
+    log::report(diagnostics);
+    
+    // Merge the results in to the target in source order.
+    for (auto& u : units) {
+        m_target.add_resources(u.target.take_resources());
+        m_imports.insert(std::end(m_imports), std::begin(u.imports), std::end(u.imports));
+        for (auto variant : u.target.variants()) {
+            m_target.declare_variant(variant);
+        }
+        for (const auto& constant : u.target.constants()) {
+            m_target.define_constant(constant);
+        }
+    }
+    
+    m_target.retain(arena);
+    for (auto& worker_arena : arenas) {
+        m_target.retain(worker_arena);
+    }
+    
+    m_ptr = m_view.size();
+    m_head = 0;
+    m_count = 0;
 }
 
-bool kdl::sema::expect(std::initializer_list<kdl::condition::truthy_function> list) const
+std::size_t kdl::sema::measure_block(kdk::span<const kdl::lexer::token> tokens, std::size_t first, bool& closed)
 {
-    auto ptr = 0;
-    for (auto f : list) {
-        if (f(peek(ptr++)) == false) {
-            return false;
+    long depth = 0;
+    for (auto n = first; n < tokens.size(); ++n) {
+        if (tokens[n].is_a(kdl::lexer::token::type::lbrace)) {
+            depth++;
+        }
+        else if (tokens[n].is_a(kdl::lexer::token::type::rbrace) && --depth <= 0) {
+            closed = true;
+            auto count = n - first + 1;
+            if (is_condition(tokens[first])) {
+                // An `@if` directive is incomplete without the block that follows it.
+                closed = false;
+                if (n + 1 < tokens.size()) {
+                    count += measure_block(tokens, n + 1, closed);
+                }
+            }
+            return count;
         }
     }
-    return true;
+    closed = false;
+    return tokens.size() - first;
 }
 
-bool kdl::sema::ensure(std::initializer_list<kdl::condition::truthy_function> list)
+// MARK: - Stream
+
+bool kdl::sema::fill(long count) const
 {
-    for (auto f : list) {
-        auto tk = read();
-        if (f(tk) == false) {
-            log::error(tk.file(), tk.line(), "Could not ensure the correctness of the token '" + tk.text() + "'");
+    if (count > lookahead_capacity) {
+        throw std::runtime_error("Attempted to look ahead beyond the capacity of the token stream.");
+    }
+    
+    while (m_count < count) {
+        auto& slot = m_lookahead[(m_head + m_count) % lookahead_capacity];
+        
+        if (m_lexer) {
+            if (!m_lexer->next(slot)) {
+                return false;
+            }
         }
+        else if (m_ptr < static_cast<long>(m_view.size())) {
+            slot = m_view[m_ptr++];
+        }
+        else {
+            return false;
+        }
+        
+        m_count++;
     }
+    
     return true;
 }
 
-kdl::condition::condition(kdl::lexer::token::type Ty)
-    : m_Ty(Ty), m_Tx("")
+bool kdl::sema::finished(long offset, long count) const
 {
-    
+    return !fill(offset + count);
 }
 
-kdl::condition::condition(const std::string Tx)
-    : m_Ty(kdl::lexer::token::type::unknown), m_Tx(Tx)
+void kdl::sema::advance(long delta)
 {
-    
+    while (delta > 0) {
+        auto n = std::min(delta, lookahead_capacity);
+        fill(n);
+        n = std::min(n, m_count);
+        if (n == 0) {
+            return;
+        }
+        m_head = (m_head + n) % lookahead_capacity;
+        m_count -= n;
+        delta -= n;
+    }
 }
 
-kdl::condition::condition(kdl::lexer::token::type Ty, const std::string Tx)
-    : m_Ty(Ty), m_Tx(Tx)
+kdl::lexer::token kdl::sema::read(long offset)
 {
-    
+    auto tk = peek(offset);
+    advance(offset + 1);
+    return tk;
 }
 
-kdl::condition::evaluation_function kdl::condition::to_be(bool r)
+const kdl::lexer::token& kdl::sema::peek(long offset) const
 {
-    auto& Tx = m_Tx;
-    auto& Ty = m_Ty;
+    // Running out of tokens part way through a construct means that the source was cut
+    // short, so it is reported after the last token.
+    if (finished(offset, 1)) {
+        const auto& last = m_lookahead[(m_head + m_count + lookahead_capacity - 1) % lookahead_capacity];
+        log::error(last.file_id(), last.lexeme_end(), "Unexpected end of input.");
+    }
     
-    return [Tx, Ty, r] (kdl::lexer::token Tk) -> bool {
-        bool outcome = true;
-        
-        if (!Tx.empty() && Tx != Tk.text()) {
-            outcome = false;
-        }
-        
-        if (Ty != kdl::lexer::token::type::unknown && !Tk.is_a(Ty)) {
-            outcome =  false;
-        }
-        
-        return (outcome == r);
-    };
+    return m_lookahead[(m_head + offset) % lookahead_capacity];
 }
 
-kdl::condition::truthy_function kdl::condition::truthy()
-{
-    return to_be(true);
-}
+// MARK: - Conditions / Expectations
 
-kdl::condition::falsey_function kdl::condition::falsey()
+void kdl::sema::unexpected(const kdl::lexer::token& tk) const
 {
-    return to_be(false);
+    log::error(tk.file_id(), tk.offset(), "Could not ensure the correctness of the token '" + std::string(tk.text()) + "'");
 }
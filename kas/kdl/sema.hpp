@@ -22,7 +22,6 @@
 
 #include <vector>
 #include <string>
-#include <initializer_list>
 #include "kdl/lexer.hpp"
 #include "structures/target.hpp"
 
@@ -32,26 +31,41 @@
 namespace kdl
 {
 
-// MARK: - Expectation Condition Templates
+// MARK: - Token Matchers
 
-struct condition {
-public:
-    typedef std::function<bool(kdl::lexer::token)> evaluation_function;
-    typedef std::function<bool(kdl::lexer::token)> truthy_function;
-    typedef std::function<bool(kdl::lexer::token)> falsey_function;
-    
-    condition(kdl::lexer::token::type Ty);
-    condition(const std::string Tx);
-    condition(kdl::lexer::token::type Ty, const std::string Tx);
-    
-    evaluation_function to_be(bool r);
-    
-    truthy_function truthy();
-    falsey_function falsey();
-    
-private:
-    kdl::lexer::token::type m_Ty;
-    std::string m_Tx;
+/**
+ * Matchers describe the tokens that the semantic analyser expects to find. They are
+ * passed as template arguments to `expect`, `ensure` and `consume`, so that each check
+ * compiles down to a handful of inline comparisons of token types, rather than building
+ * and calling function objects.
+ *
+ *  sema->expect<is<lexer::token::type::identifier>, is_not<lexer::token::type::equals>>()
+ *
+ */
+
+/**
+ * Matches a token that is any one of the specified types. Keywords also match
+ * `identifier`.
+ */
+template<kdl::lexer::token::type... Ty>
+struct is
+{
+    static bool test(const kdl::lexer::token& tk)
+    {
+        return (tk.is_a(Ty) || ...);
+    }
+};
+
+/**
+ * Matches a token that is none of the specified types.
+ */
+template<kdl::lexer::token::type... Ty>
+struct is_not
+{
+    static bool test(const kdl::lexer::token& tk)
+    {
+        return !(tk.is_a(Ty) || ...);
+    }
 };
 
 // MARK: - Semantic Analysis
@@ -66,26 +80,71 @@ class sema
 public:
     
     /**
-     * Construct a new `kdl::sema` instance using the specified token stream.
+     * Construct a new `kdl::sema` instance using the specified token stream. The
+     * token stream is taken over by the semantic analyser, so callers should move
+     * it in rather than copy it.
+     */
+    sema(kdk::target target, std::vector<kdl::lexer::token> tokens);
+    
+    /**
+     * Construct a new `kdl::sema` instance over a run of tokens owned by the caller. The
+     * tokens are not copied, and must outlive the semantic analyser.
+     */
+    sema(kdk::target target, kdk::span<const kdl::lexer::token> tokens);
+    
+    /**
+     * Construct a new `kdl::sema` instance that pulls tokens from the specified lexer
+     * on demand. Only a small window of lookahead tokens is ever held, which allows
+     * parsing to overlap lexing. The lexer must outlive the semantic analyser.
      */
-    sema(kdk::target target, const std::vector<kdl::lexer::token> tokens);
+    sema(kdk::target target, kdl::lexer& lexer);
+    
+    /**
+     * The maximum number of tokens that can be looked ahead at once through `peek`,
+     * `expect` and `finished`.
+     */
+    static constexpr long lookahead_capacity = 8;
     
     /**
      * Run/perform semantic analysis on the token stream.
      */
     void run();
     
+    /**
+     * Run semantic analysis on the token stream, parsing the top level declarations
+     * concurrently. A quick prescan matches braces to find the extent of each top level
+     * block. Declarations are then parsed on worker threads, and everything else, such
+     * as directives, is parsed on the calling thread in source order. The resulting
+     * resources are added to the target in source order, so the output is the same as
+     * for `run`.
+     *
+     * If more than one block contains an error, then which one is reported is not
+     * defined. A semantic analyser that streams tokens from a lexer is always run
+     * sequentially.
+     */
+    void run_parallel(unsigned concurrency = 0);
+    
+    /**
+     * Measure the number of tokens in the top level block starting at the specified
+     * token. A block extends up to and including the brace that closes its first opening
+     * brace. If the block is never closed it extends to the end of the tokens. An `@if`
+     * directive forms a single block together with the block that follows it, and is not
+     * closed until that block is.
+     */
+    static std::size_t measure_block(kdk::span<const kdl::lexer::token> tokens, std::size_t first, bool& closed);
+    
     /**
      * Check if the semantic analysis has reached the end of the token stream.
      */
     bool finished(long offset = 0, long count = 1) const;
    
     /**
-     * Keep consuming tokens until the expectation is met.
+     * Keep consuming tokens for as long as they match.
      *
      * \return A vector containing all the tokens that were consumed.
      */
-    std::vector<kdl::lexer::token> consume(kdl::condition::falsey_function f);
+    template<typename Matcher>
+    std::vector<kdl::lexer::token> consume();
     
     /**
      * Advance past the specified number of tokens.
@@ -98,37 +157,130 @@ public:
     kdl::lexer::token read(long offset = 0);
     
     /**
-     * Peek a token from the token stream.
-     */
-    kdl::lexer::token peek(long offset = 0) const;
-    
-    /**
-     * Validate the expectation of a token.
+     * Peek a token from the token stream. The reference is only valid until the
+     * token stream is next advanced. Peeking past the end of the token stream is
+     * reported as an unexpected end of input.
      */
-    bool expect(kdl::condition::truthy_function f) const;
+    const kdl::lexer::token& peek(long offset = 0) const;
     
     /**
-     * Validate the expection of a sequence of tokens.
+     * Validate the expectation of a sequence of tokens, with each matcher being
+     * tested against the corresponding upcoming token. Returns false if the token
+     * stream ends before the sequence does.
      */
-    bool expect(std::initializer_list<kdl::condition::truthy_function> f) const;
+    template<typename... Matchers>
+    bool expect() const;
     
     /**
      * Ensure the next sequence of tokens matches exactly what is specified.
      * Each token is advanced past.
      */
-     bool ensure(std::initializer_list<kdl::condition::truthy_function> f);
+    template<typename... Matchers>
+    void ensure();
     
     /**
      * Returns a reference to the current target.
      */
     kdk::target& target();
     
+    /**
+     * Record a file that has been imported by the token stream. The imported file is not
+     * parsed by the semantic analyser itself. It is left for the `kdl::importer` to load.
+     */
+    void add_import(const kdl::lexer::token& path);
+    
+    /**
+     * Returns the string tokens naming each of the files imported by the token stream, in
+     * source order.
+     */
+    const std::vector<kdl::lexer::token>& imports() const;
+    
+    /**
+     * Set the variants that the resources of the next declaration are included in.
+     */
+    void set_condition(std::vector<kdk::atom> variants);
+    
+    /**
+     * Returns the variants set through `set_condition`, and clears them so that they only
+     * apply to a single declaration.
+     */
+    std::vector<kdk::atom> take_condition();
+    
 private:
-    long m_ptr { 0 };
+    /**
+     * Check the next token against a matcher, and advance past it. A token that does
+     * not match is reported as an error.
+     */
+    template<typename Matcher>
+    void ensure_next();
+    
+    /**
+     * Report a token that did not match what was expected.
+     */
+    void unexpected(const kdl::lexer::token& tk) const;
+    
+    /**
+     * Pull tokens from the token source into the lookahead buffer until at least the
+     * specified number of tokens are buffered, or the source is exhausted.
+     *
+     * \return true if the requested number of tokens are available.
+     */
+    bool fill(long count) const;
+    
+private:
+    mutable long m_ptr { 0 };
     std::vector<kdl::lexer::token> m_tokens;
+    kdk::span<const kdl::lexer::token> m_view;
+    kdl::lexer *m_lexer { nullptr };
+    mutable kdl::lexer::token m_lookahead[lookahead_capacity];
+    mutable long m_head { 0 };
+    mutable long m_count { 0 };
     kdk::target m_target { "" };
+    std::vector<kdl::lexer::token> m_imports;
+    std::vector<kdk::atom> m_condition;
 };
 
+// MARK: - Expectations
+
+template<typename Matcher>
+inline std::vector<kdl::lexer::token> sema::consume()
+{
+    std::vector<kdl::lexer::token> v;
+    
+    while (!finished() && Matcher::test(peek())) {
+        v.push_back(read());
+    }
+    
+    return v;
+}
+
+template<typename... Matchers>
+inline bool sema::expect() const
+{
+    if (finished(0, sizeof...(Matchers))) {
+        return false;
+    }
+    
+    long offset = 0;
+    return (Matchers::test(peek(offset++)) && ...);
+}
+
+template<typename Matcher>
+inline void sema::ensure_next()
+{
+    const auto& tk = peek();
+    if (!Matcher::test(tk)) {
+        unexpected(tk);
+    }
+    advance();
+}
+
+template<typename... Matchers>
+inline void sema::ensure()
+{
+    (ensure_next<Matchers>(), ...);
+}
+
 
 };
 
@@ -22,7 +22,9 @@
 
 #include <iostream>
 #include <stdexcept>
+#include <limits>
 #include "kdl/sema/declaration.hpp"
+#include "kdl/sema/expression.hpp"
 #include "structures/resource.hpp"
 #include "diagnostic/log.hpp"
 
@@ -30,108 +32,176 @@
 
 bool kdl::declaration::test(kdl::sema *sema)
 {
-    return sema->expect({
-        kdl::condition(lexer::token::type::identifier, "declare").truthy(),
-        kdl::condition(lexer::token::type::identifier).truthy(),
-        kdl::condition(lexer::token::type::lbrace).truthy()
-    });
+    return sema->expect<is<lexer::token::type::keyword_declare>, is<lexer::token::type::identifier>, is<lexer::token::type::lbrace>>();
 }
 
 
 void kdl::declaration::parse(kdl::sema *sema)
 {
     // Ensure declaration.
-    sema->ensure({
-        condition(lexer::token::type::identifier, "declare").truthy()
-    });
+    sema->ensure<is<lexer::token::type::keyword_declare>>();
     
     // Declaration structure: declare StructureName { <args> }
-    auto structure_name = sema->read().text();
+    auto structure_name = sema->read().atom();
+    auto condition = sema->take_condition();
     std::vector<kdk::resource> m_instances;
+    scratch scratch;
     
-    sema->ensure({
-        condition(lexer::token::type::lbrace).truthy()
-    });
+    sema->ensure<is<lexer::token::type::lbrace>>();
     
     // The general structure of declarations is consistant between StructureTypes.
     // This should allow us to parse out a set of resource instances
-    while (sema->expect({ condition(lexer::token::type::rbrace).falsey() })) {
+    while (sema->expect<is_not<lexer::token::type::rbrace>>()) {
         
         // An instance of resource is denoted by the "new" keyword.
         
-        if (sema->expect({ condition(lexer::token::type::identifier, "new").truthy() })) {
-            m_instances.push_back(parse_instance(sema, structure_name));
+        if (sema->expect<is<lexer::token::type::keyword_new>>()) {
+            m_instances.push_back(parse_instance(sema, structure_name, scratch));
+        }
+        else {
+            log::error(sema->peek().file_id(), sema->peek().offset(), "Expected a resource instance, introduced by 'new', but found '" + std::string(sema->peek().text()) + "'.");
         }
         
     }
     
-    sema->ensure({
-        condition(lexer::token::type::rbrace).truthy()
-    });
+    sema->ensure<is<lexer::token::type::rbrace>>();
+    
+    // Resources declared under an `@if` directive are only included in the variants that it
+    // named. The instances all share a single copy of the variants.
+    if (!condition.empty()) {
+        auto variants = sema->target().arena().copy(condition.data(), condition.size());
+        for (auto& instance : m_instances) {
+            instance.set_variants(variants);
+        }
+    }
     
     // Prepare to add the structure type and all instances into the target.
-    sema->target().add_resources(m_instances);
+    sema->target().add_resources(std::move(m_instances));
 }
 
-kdk::resource kdl::declaration::parse_instance(kdl::sema *sema, const std::string type)
+kdk::resource kdl::declaration::parse_instance(kdl::sema *sema, const kdk::atom type, kdl::declaration::scratch& scratch)
 {
-    sema->ensure({
-        condition(lexer::token::type::identifier, "new").truthy(),
-        condition(lexer::token::type::lparen).truthy()
-    });
+    auto keyword = sema->peek();
+    sema->ensure<is<lexer::token::type::keyword_new>>();
     
+    static const kdk::atom base_attribute { "base" };
+    static const kdk::atom range_keyword { "range" };
     int64_t resource_id { 0 };
     std::string resource_name { "" };
+    std::string_view name_text;
+    auto has_base = false;
+    int64_t base_id { 0 };
+    
+    // A range of resources is introduced by "new range(#first ... #last, ...)", and has
+    // its ids given by the range rather than by an attribute.
+    auto is_range = sema->expect<is<lexer::token::type::identifier>, is<lexer::token::type::lparen>>() && sema->peek().atom() == range_keyword;
+    auto has_attributes = true;
+    int64_t range_last { 0 };
+    
+    if (is_range) {
+        sema->ensure<is<lexer::token::type::identifier>, is<lexer::token::type::lparen>>();
+        
+        if (!sema->expect<is<lexer::token::type::resource_id>, is<lexer::token::type::dot>, is<lexer::token::type::dot>, is<lexer::token::type::dot>, is<lexer::token::type::resource_id>>()) {
+            log::error(sema->peek().file_id(), sema->peek().offset(), "A range of resources must be given as '#first ... #last'.");
+        }
+        auto first = sema->read();
+        sema->advance(3);
+        auto last = sema->read();
+        resource_id = first.value();
+        range_last = last.value();
+        
+        // Every resource of the range is created up front, so the range is limited to the ids
+        // that a resource can actually be given.
+        for (const auto& endpoint : { first, last }) {
+            if (endpoint.value() < std::numeric_limits<int16_t>::min() || endpoint.value() > std::numeric_limits<int16_t>::max()) {
+                log::error(endpoint.file_id(), endpoint.offset(), "The resource id '#" + std::string(endpoint.text()) + "' is outside of the range of resource ids.");
+            }
+        }
+        if (range_last < resource_id) {
+            log::error(last.file_id(), last.offset(), "The last resource id of a range must not be less than the first.");
+        }
+        
+        if (sema->expect<is<lexer::token::type::comma>>()) {
+            sema->advance();
+        }
+        else {
+            sema->ensure<is<lexer::token::type::rparen>>();
+            has_attributes = false;
+        }
+    }
+    else {
+        sema->ensure<is<lexer::token::type::lparen>>();
+    }
     
     // We need to parse attributes until we hit a closing parentheses.
-    while (sema->expect(condition(lexer::token::type::rparen).falsey())) {
+    while (has_attributes && sema->expect<is_not<lexer::token::type::rparen>>()) {
         
-        if (sema->expect({ condition(lexer::token::type::identifier).falsey(), condition(lexer::token::type::equals).falsey() })) {
-            log::error(sema->peek().file(), sema->peek().line(), "Malformed resource attribute encountered.");
+        if (sema->expect<is_not<lexer::token::type::identifier>, is_not<lexer::token::type::equals>>()) {
+            log::error(sema->peek().file_id(), sema->peek().offset(), "Malformed resource attribute encountered.");
         }
-        auto attribute = sema->read().text();
+        auto attribute = sema->read();
         sema->advance();
         
-        if (attribute == "id") {
+        if (attribute.is_a(lexer::token::type::keyword_id)) {
+            if (is_range) {
+                log::error(attribute.file_id(), attribute.offset(), "A range of resources takes its ids from the range, and can not be given an 'id' attribute.");
+            }
+            
             // We're expecting a resource id now.
-            if (sema->expect({ condition(lexer::token::type::resource_id).falsey() })) {
-                log::error(sema->peek().file(), sema->peek().line(), "The 'id' attribute must be assigned a resource id literal.");
+            if (sema->expect<is_not<lexer::token::type::resource_id>>()) {
+                log::error(sema->peek().file_id(), sema->peek().offset(), "The 'id' attribute must be assigned a resource id literal.");
             }
-            resource_id = std::stoi(sema->read().text());
+            resource_id = sema->read().value();
         }
-        else if (attribute == "name") {
+        else if (attribute.is_a(lexer::token::type::keyword_name)) {
             // We're expecting a string now.
-            if (sema->expect({ condition(lexer::token::type::string).falsey() })) {
-                log::error(sema->peek().file(), sema->peek().line(), "The 'name' attribute must be assigned a string literal.");
+            if (sema->expect<is_not<lexer::token::type::string>>()) {
+                log::error(sema->peek().file_id(), sema->peek().offset(), "The 'name' attribute must be assigned a string literal.");
+            }
+            name_text = sema->read().text();
+            resource_name = std::string(name_text);
+        }
+        else if (attribute.atom() == base_attribute) {
+            // We're expecting the resource id of the base resource now.
+            if (sema->expect<is_not<lexer::token::type::resource_id>>()) {
+                log::error(sema->peek().file_id(), sema->peek().offset(), "The 'base' attribute must be assigned a resource id literal.");
             }
-            resource_name = sema->read().text();
+            has_base = true;
+            base_id = sema->read().value();
         }
         else {
             // Unrecognised attribute.
-            log::error(sema->peek().file(), sema->peek().line(), "Unrecognised resource attribute '" + attribute + "' encountered.");
+            log::error(sema->peek().file_id(), sema->peek().offset(), "Unrecognised resource attribute '" + std::string(attribute.text()) + "' encountered.");
         }
         
         // Check for a comma. If no comma exists, then we require the presence of a rparen.
-        if (sema->expect({ condition(lexer::token::type::comma).truthy() })) {
+        if (sema->expect<is<lexer::token::type::comma>>()) {
             sema->advance();
             continue;
         }
         
-        sema->ensure({ condition(lexer::token::type::rparen).truthy() });
+        sema->ensure<is<lexer::token::type::rparen>>();
         break;
         
     }
     
     // Construct the base resource object in preparation for adding fields and values to it.
     kdk::resource resource { type, resource_id, resource_name };
+    resource.set_source(keyword.file_id(), keyword.text());
+    if (has_base) {
+        resource.set_base_id(base_id);
+    }
+    if (is_range) {
+        resource.set_range(sema->target().arena(), range_last, name_text);
+    }
+    scratch.values.clear();
+    scratch.fields.clear();
     
     // All fields are contained with in a block ( { ... } ). Ensure we have an opening brace, and then keep
     // parsing until the corresponding closing brace is found.
-    sema->ensure({
-        condition(lexer::token::type::lbrace).truthy()
-    });
+    sema->ensure<is<lexer::token::type::lbrace>>();
     
-    while ( sema->expect({ condition(lexer::token::type::rbrace).falsey() }) ) {
+    while ( sema->expect<is_not<lexer::token::type::rbrace>>() ) {
         
         // Resource fields have the following grammar:
         //  field_name = value...;
@@ -144,6 +214,7 @@ kdk::resource kdl::declaration::parse_instance(kdl::sema *sema, const std::strin
         //      percentage
         //      identifier
         //      identifier<file> ( string )
+        //      expression
         //
         // Each of these need to be correctly parsed and encoded into a field structure
         // and stored in the resource. This part of the parser is not validing the valuetypes
@@ -151,95 +222,96 @@ kdk::resource kdl::declaration::parse_instance(kdl::sema *sema, const std::strin
         // There can be one or more values, and values are consumed until a semi-colon is
         // found. There _must_ be at least one value provided.
         
-        if ( sema->expect({ condition(lexer::token::type::identifier).falsey() })) {
-            log::error(sema->peek().file(), sema->peek().line(), "Resource field name must be an identifier.");
+        if ( sema->expect<is_not<lexer::token::type::identifier>>()) {
+            log::error(sema->peek().file_id(), sema->peek().offset(), "Resource field name must be an identifier.");
         }
-        auto field_name = sema->read().text();
+        auto field_name = sema->read();
         
-        sema->ensure({
-            condition(lexer::token::type::equals).truthy()
-        });
+        sema->ensure<is<lexer::token::type::equals>>();
         
-        std::vector<std::tuple<std::string, kdk::resource::field::value_type>> values { 0 };
+        auto& values = scratch.values;
+        auto first_value = values.size();
         
-        while ( sema->expect({ condition(lexer::token::type::semi_colon).falsey() }) ) {
+        while ( sema->expect<is_not<lexer::token::type::semi_colon>>() ) {
             
             // Validate the value token.
-            if ( sema->expect({ condition(lexer::token::type::string).truthy() }) ) {
+            if ( kdl::expression::test(sema) ) {
+                // Arithmetic expression...
+                values.push_back( kdl::expression::parse(sema, true) );
+            }
+            else if ( sema->expect<is<lexer::token::type::string>>() ) {
                 // String value...
-                values.push_back( std::make_tuple(sema->read().text(), kdk::resource::field::value_type::string) );
+                values.emplace_back( kdk::resource::field::value_type::string, sema->read().text() );
             }
-            else if ( sema->expect({ condition(lexer::token::type::integer).truthy() }) ) {
+            else if ( sema->expect<is<lexer::token::type::integer>>() ) {
                 // Integer value...
-                values.push_back( std::make_tuple(sema->read().text(), kdk::resource::field::value_type::integer) );
+                values.emplace_back( kdk::resource::field::value_type::integer, sema->read().value() );
             }
-            else if ( sema->expect({ condition(lexer::token::type::percentage).truthy() }) ) {
+            else if ( sema->expect<is<lexer::token::type::percentage>>() ) {
                 // Percentage value...
-                values.push_back( std::make_tuple(sema->read().text(), kdk::resource::field::value_type::percentage) );
+                values.emplace_back( kdk::resource::field::value_type::percentage, sema->read().value() );
             }
-            else if ( sema->expect({ condition(lexer::token::type::resource_id).truthy() }) ) {
+            else if ( sema->expect<is<lexer::token::type::resource_id>>() ) {
                 // Resource ID value...
-                values.push_back( std::make_tuple(sema->read().text(), kdk::resource::field::value_type::resource_id) );
+                values.emplace_back( kdk::resource::field::value_type::resource_id, sema->read().value() );
             }
-            else if ( sema->expect({ condition(lexer::token::type::identifier, "file").truthy() }) ) {
+            else if ( sema->expect<is<lexer::token::type::keyword_file>>() ) {
                 // File reference value...
-                sema->ensure({
-                    condition(lexer::token::type::identifier, "file").truthy(),
-                    condition(lexer::token::type::lparen).truthy()
-                });
+                sema->ensure<is<lexer::token::type::keyword_file>, is<lexer::token::type::lparen>>();
                 
-                if (sema->expect({ condition(lexer::token::type::string).falsey(), condition(lexer::token::type::rparen).falsey() })) {
-                    log::error(sema->peek().file(), sema->peek().line(), "Malformed file reference found.");
+                if (sema->expect<is_not<lexer::token::type::string>, is_not<lexer::token::type::rparen>>()) {
+                    log::error(sema->peek().file_id(), sema->peek().offset(), "Malformed file reference found.");
                 }
                 
-                values.push_back( std::make_tuple(sema->read().text(), kdk::resource::field::value_type::file_reference) );
+                values.emplace_back( kdk::resource::field::value_type::file_reference, sema->read().text() );
                 sema->advance();
             }
-            else if ( sema->expect({ condition(lexer::token::type::identifier, "rgb").truthy() }) ) {
+            else if ( sema->expect<is<lexer::token::type::keyword_rgb>>() ) {
                 // RGB Color value...
-                sema->ensure({
-                    condition(lexer::token::type::identifier, "rgb").truthy(),
-                    condition(lexer::token::type::lparen).truthy()
-                });
+                sema->ensure<is<lexer::token::type::keyword_rgb>, is<lexer::token::type::lparen>>();
                 
-                if (sema->expect({
-                    condition(lexer::token::type::integer).falsey(),
-                    condition(lexer::token::type::integer).falsey(),
-                    condition(lexer::token::type::integer).falsey(),
-                    condition(lexer::token::type::rparen).falsey()
-                })) {
-                    log::error(sema->peek().file(), sema->peek().line(), "Malformed RGB color found.");
+                // The components have already been decoded by the lexer, so they only need
+                // to be range checked before being packed.
+                uint32_t rgb = 0;
+                for (auto n = 0; n < 3; ++n) {
+                    if (!sema->expect<is<lexer::token::type::integer>>()) {
+                        log::error(sema->peek().file_id(), sema->peek().offset(), "Malformed RGB color found. Expected three integer components.");
+                    }
+                    
+                    auto component = sema->read();
+                    if (component.value() < 0 || component.value() > 255) {
+                        log::error(component.file_id(), component.offset(), "RGB color component '" + std::string(component.text()) + "' is out of range.");
+                    }
+                    rgb = (rgb << 8) | static_cast<uint32_t>(component.value());
                 }
                 
-                auto red = static_cast<uint8_t>(std::stoi(sema->read().text()));
-                auto green = static_cast<uint8_t>(std::stoi(sema->read().text()));
-                auto blue = static_cast<uint8_t>(std::stoi(sema->read().text()));
-                uint32_t rgb = (red << 16) | (green << 8) | (blue);
-                
-                values.push_back( std::make_tuple(std::to_string(rgb), kdk::resource::field::value_type::color) );
+                if (!sema->expect<is<lexer::token::type::rparen>>()) {
+                    log::error(sema->peek().file_id(), sema->peek().offset(), "Malformed RGB color found. Expected a ')' after the third component.");
+                }
                 sema->advance();
+                
+                values.emplace_back( kdk::resource::field::value_type::color, static_cast<int64_t>(rgb) );
             }
-            else if ( sema->expect({ condition(lexer::token::type::identifier).truthy() }) ) {
+            else if ( sema->expect<is<lexer::token::type::identifier>>() ) {
                 // Identifier reference...
-                values.push_back( std::make_tuple(sema->read().text(), kdk::resource::field::value_type::identifier) );
+                auto identifier = sema->read();
+                values.emplace_back( identifier.text(), identifier.atom() );
             }
             else {
-                log::error(sema->peek().file(), sema->peek().line(), "Unexpected value type encountered.");
+                log::error(sema->peek().file_id(), sema->peek().offset(), "Unexpected value type encountered.");
             }
             
         }
         
-        sema->ensure({
-            condition(lexer::token::type::semi_colon).truthy()
-        });
+        sema->ensure<is<lexer::token::type::semi_colon>>();
         
-        kdk::resource::field field { field_name, values };
-        resource.add_field(field);
+        scratch.fields.emplace_back(field_name.atom(), field_name.text(), values.size() - first_value);
     }
     
-    sema->ensure({
-        condition(lexer::token::type::rbrace).truthy()
-    });
+    sema->ensure<is<lexer::token::type::rbrace>>();
+    
+    // Move the fields and values in to the arena.
+    resource.set_fields(sema->target().arena(), scratch.fields, scratch.values);
     
     return resource;
 }
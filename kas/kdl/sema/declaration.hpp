@@ -22,6 +22,8 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
+#include <tuple>
 #include "kdl/lexer.hpp"
 #include "kdl/sema.hpp"
 #include "structures/resource.hpp"
@@ -57,7 +59,18 @@ public:
     static void parse(kdl::sema *sema);
     
 private:
-    static kdk::resource parse_instance(kdl::sema *sema, const std::string type);
+    /**
+     * Working storage for the fields of the instance being parsed. It is reused from one
+     * instance to the next, and each completed instance has its fields and values copied
+     * in to the arena of the target as contiguous runs.
+     */
+    struct scratch
+    {
+        std::vector<kdk::resource::field::value> values;
+        std::vector<std::tuple<kdk::atom, std::string_view, std::size_t>> fields;
+    };
+    
+    static kdk::resource parse_instance(kdl::sema *sema, const kdk::atom type, scratch& scratch);
 };
 
 };
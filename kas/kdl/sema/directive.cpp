@@ -23,47 +23,110 @@
 #include <iostream>
 #include <stdexcept>
 #include "kdl/sema/directive.hpp"
+#include "kdl/sema/declaration.hpp"
+#include "kdl/sema/expression.hpp"
 #include "diagnostic/log.hpp"
 
 // MARK: - Parser
 
 bool kdl::directive::test(kdl::sema *sema)
 {
-    return sema->expect(condition(kdl::lexer::token::type::directive).truthy());
+    return sema->expect<is<lexer::token::type::directive>>();
 }
 
 
 void kdl::directive::parse(kdl::sema *sema)
 {
     // Ensure directive.
-    if (sema->expect(condition(kdl::lexer::token::type::directive).falsey())) {
+    if (sema->expect<is_not<lexer::token::type::directive>>()) {
         auto tk = sema->peek();
-        log::error(tk.file(), tk.line(), "Unexpected token '" + tk.text() + "' encountered while parsing directive.");
+        log::error(tk.file_id(), tk.offset(), "Unexpected token '" + std::string(tk.text()) + "' encountered while parsing directive.");
     }
     
+    // Directives are recognised by their interned names, so that each is told apart by a
+    // single comparison rather than a string comparison.
+    static const kdk::atom define_directive { "define" };
+    static const kdk::atom out_directive { "out" };
+    static const kdk::atom import_directive { "import" };
+    static const kdk::atom variant_directive { "variant" };
+    static const kdk::atom condition_directive { "if" };
+    
     // Directive structure: @directive { <args> }
-    auto directive = sema->read().text();
+    auto directive_token = sema->read();
+    auto directive = directive_token.atom();
     
-    if (sema->expect(condition(kdl::lexer::token::type::lbrace).falsey())) {
+    if (sema->expect<is_not<lexer::token::type::lbrace>>()) {
         auto tk = sema->peek();
-        log::error(tk.file(), tk.line(), "Expected '{' whilst starting directive, but found '" + tk.text() + "' instead.");
+        log::error(tk.file_id(), tk.offset(), "Expected '{' whilst starting directive, but found '" + std::string(tk.text()) + "' instead.");
     }
     sema->advance();
     
+    // Constants are given as a list of assignments, rather than as plain arguments.
+    //  @define { NAME = expression; ... }
+    if (directive == define_directive) {
+        while (sema->expect<is_not<lexer::token::type::rbrace>>()) {
+            if (!sema->expect<is<lexer::token::type::identifier>, is<lexer::token::type::equals>>()) {
+                auto tk = sema->peek();
+                log::error(tk.file_id(), tk.offset(), "Expected the definition of a constant, but found '" + std::string(tk.text()) + "' instead.");
+            }
+            auto name = sema->read();
+            sema->advance();
+            
+            auto value = kdl::expression::parse(sema);
+            sema->ensure<is<lexer::token::type::semi_colon>>();
+            sema->target().define_constant({ name.atom(), name.file_id(), name.offset(), value });
+        }
+        sema->advance();
+        return;
+    }
+    
     // Consume each of the arguments.
-    auto args = sema->consume(condition(kdl::lexer::token::type::rbrace).falsey());
+    auto args = sema->consume<is_not<lexer::token::type::rbrace>>();
     
-    if (sema->expect(condition(kdl::lexer::token::type::rbrace).falsey())) {
+    if (sema->expect<is_not<lexer::token::type::rbrace>>()) {
         auto tk = sema->peek();
-        log::error(tk.file(), tk.line(), "Expected '}' whilst finishing directive, but found '" + tk.text() + "' instead.");
+        log::error(tk.file_id(), tk.offset(), "Expected '}' whilst finishing directive, but found '" + std::string(tk.text()) + "' instead.");
     }
     sema->advance();
     
     // Prepare to execute the directive.
     
-    if (directive == "out") {
+    if (directive == out_directive) {
         for (auto a : args) {
             std::cout << a.text() << std::endl;
         }
     }
+    else if (directive == import_directive) {
+        for (auto a : args) {
+            if (!a.is_a(lexer::token::type::string)) {
+                log::error(a.file_id(), a.offset(), "Expected the name of a file to import, but found '" + std::string(a.text()) + "' instead.");
+            }
+            sema->add_import(a);
+        }
+    }
+    else if (directive == variant_directive) {
+        for (auto a : args) {
+            if (!a.is_a(lexer::token::type::identifier)) {
+                log::error(a.file_id(), a.offset(), "Expected the name of a variant, but found '" + std::string(a.text()) + "' instead.");
+            }
+            sema->target().declare_variant(a.atom());
+        }
+    }
+    else if (directive == condition_directive) {
+        std::vector<kdk::atom> variants;
+        for (auto a : args) {
+            if (!a.is_a(lexer::token::type::identifier)) {
+                log::error(a.file_id(), a.offset(), "Expected the name of a variant, but found '" + std::string(a.text()) + "' instead.");
+            }
+            variants.push_back(a.atom());
+        }
+        
+        if (variants.empty()) {
+            log::error(directive_token.file_id(), directive_token.offset(), "The '@if' directive must name at least one variant.");
+        }
+        if (!kdl::declaration::test(sema)) {
+            log::error(directive_token.file_id(), directive_token.offset(), "The '@if' directive must be followed by a declaration.");
+        }
+        sema->set_condition(variants);
+    }
 }
@@ -0,0 +1,481 @@
+/*
+* Copyright (c) 2019 Tom Hancocks
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+#include "kdl/sema/expression.hpp"
+#include "kdl/source_manager.hpp"
+#include "diagnostic/log.hpp"
+
+// MARK: - Evaluation
+
+namespace
+{
+
+using value = kdk::resource::field::value;
+using value_type = kdk::resource::field::value_type;
+
+/**
+ * An intermediate result of an expression. A result that depends on a constant that is
+ * not yet known has no number, but is still parsed so that the extent of the expression
+ * can be found.
+ */
+struct operand
+{
+    value_type type { value_type::integer };
+    int64_t number { 0 };
+    bool known { true };
+};
+
+/**
+ * Returns the name of a numeric value type, for use in diagnostics.
+ */
+std::string describe(value_type type)
+{
+    switch (type) {
+        case value_type::percentage: return "percentage";
+        case value_type::resource_id: return "resource id";
+        default: return "integer";
+    }
+}
+
+/**
+ * The constants of a target, which are folded on demand as they are used. Constants may
+ * be defined in terms of each other in any order, and a constant that is reached again
+ * while it is being folded forms a cycle.
+ */
+class constant_table
+{
+public:
+    constant_table(const std::vector<kdk::target::constant>& constants);
+    
+    /**
+     * Returns the value of the constant named by the token, reporting an error if there is
+     * no such constant.
+     */
+    value named(const kdl::lexer::token& name);
+    
+    /**
+     * Returns the value of the constant with the specified name, if there is one.
+     */
+    std::optional<value> find(kdk::atom name);
+    
+    /**
+     * Fold every constant, whether or not it is used, so that errors in it are reported.
+     */
+    void fold_all();
+    
+private:
+    enum class state { pending, folding, folded };
+    
+    value fold(std::size_t n);
+    
+private:
+    const std::vector<kdk::target::constant>& m_constants;
+    std::unordered_map<kdk::atom, std::size_t> m_names;
+    std::vector<state> m_states;
+    std::vector<value> m_values;
+};
+
+/**
+ * A cursor over the tokens of an expression that is being folded. It provides the parts
+ * of the interface of `kdl::sema` that the evaluator uses, without needing a target.
+ */
+class token_cursor
+{
+public:
+    token_cursor(const std::vector<kdl::lexer::token>& tokens)
+        : m_tokens(tokens)
+    {
+        
+    }
+    
+    bool finished(long offset = 0, long count = 1) const
+    {
+        return m_next + offset + count > m_tokens.size();
+    }
+    
+    template<typename... Matchers>
+    bool expect() const
+    {
+        if (finished(0, sizeof...(Matchers))) {
+            return false;
+        }
+        auto n = m_next;
+        return (Matchers::test(m_tokens[n++]) && ...);
+    }
+    
+    const kdl::lexer::token& peek(long offset = 0) const
+    {
+        return m_tokens[m_next + offset];
+    }
+    
+    kdl::lexer::token read()
+    {
+        return m_tokens[m_next++];
+    }
+    
+private:
+    const std::vector<kdl::lexer::token>& m_tokens;
+    std::size_t m_next { 0 };
+};
+
+/**
+ * A recursive descent evaluator over a stream of tokens, following the usual precedence
+ * of the arithmetic operators.
+ *
+ *  sum     := product (('+' | '-') product)*
+ *  product := unary (('*' | '/') unary)*
+ *  unary   := '-' unary | primary
+ *  primary := integer | percentage | resource_id | identifier | '(' sum ')'
+ *
+ * Without a table of constants, any expression that names a constant is not known. When
+ * the expression is one of a list of values, a '-' that has whitespace before it but none
+ * after it, outside of any parentheses, starts the next value rather than subtracting.
+ */
+template<typename Stream>
+class evaluator
+{
+public:
+    evaluator(Stream& stream, constant_table *constants, bool in_list)
+        : m_stream(stream), m_constants(constants), m_in_list(in_list)
+    {
+        
+    }
+    
+    /**
+     * Returns the last token of the expression that has been evaluated.
+     */
+    const kdl::lexer::token& last() const
+    {
+        return m_last;
+    }
+    
+    operand sum()
+    {
+        auto lhs = product();
+        while (m_stream.template expect<kdl::is<kdl::lexer::token::type::plus, kdl::lexer::token::type::minus>>() && !starts_value()) {
+            auto op = m_stream.read();
+            lhs = combine(op, lhs, product());
+        }
+        return lhs;
+    }
+    
+private:
+    /**
+     * Test if the upcoming '-' is the sign of the next value in a list, rather than an
+     * operator.
+     */
+    bool starts_value() const
+    {
+        if (!m_in_list || m_depth > 0 || m_stream.finished(0, 2)) {
+            return false;
+        }
+        
+        const auto op = m_stream.peek();
+        const auto next = m_stream.peek(1);
+        return op.is_a(kdl::lexer::token::type::minus)
+            && op.lexeme_begin() > m_last.lexeme_end()
+            && op.lexeme_end() == next.lexeme_begin();
+    }
+    
+    operand product()
+    {
+        auto lhs = unary();
+        while (m_stream.template expect<kdl::is<kdl::lexer::token::type::star, kdl::lexer::token::type::slash>>()) {
+            auto op = m_stream.read();
+            lhs = combine(op, lhs, unary());
+        }
+        return lhs;
+    }
+    
+    operand unary()
+    {
+        if (!m_stream.template expect<kdl::is<kdl::lexer::token::type::minus>>()) {
+            return primary();
+        }
+        
+        auto op = m_stream.read();
+        auto result = unary();
+        if (result.known && __builtin_sub_overflow(int64_t(0), result.number, &result.number)) {
+            log::error(op.file_id(), op.offset(), "The expression overflows.");
+        }
+        return result;
+    }
+    
+    operand primary()
+    {
+        if (m_stream.finished()) {
+            log::error(m_last.file_id(), m_last.offset(), "Expected a value to follow '" + std::string(m_last.text()) + "' in the expression.");
+        }
+        
+        auto tk = m_stream.read();
+        m_last = tk;
+        
+        if (tk.is_a(kdl::lexer::token::type::lparen)) {
+            m_depth++;
+            auto result = sum();
+            m_depth--;
+            if (!m_stream.template expect<kdl::is<kdl::lexer::token::type::rparen>>()) {
+                log::error(tk.file_id(), tk.offset(), "Expected a ')' to close the '(' in the expression.");
+            }
+            m_last = m_stream.read();
+            return result;
+        }
+        else if (tk.is_a(kdl::lexer::token::type::integer)) {
+            return { value_type::integer, tk.value() };
+        }
+        else if (tk.is_a(kdl::lexer::token::type::percentage)) {
+            return { value_type::percentage, tk.value() };
+        }
+        else if (tk.is_a(kdl::lexer::token::type::resource_id)) {
+            return { value_type::resource_id, tk.value() };
+        }
+        else if (tk.is_a(kdl::lexer::token::type::identifier)) {
+            if (!m_constants) {
+                return { value_type::integer, 0, false };
+            }
+            auto constant = m_constants->named(tk);
+            return { constant.type(), constant.number() };
+        }
+        
+        log::error(tk.file_id(), tk.offset(), "Expected a value in the expression, but found '" + std::string(tk.text()) + "' instead.");
+        return {};
+    }
+    
+    operand combine(const kdl::lexer::token& op, operand lhs, operand rhs)
+    {
+        // An integer takes on the type of whatever it is combined with, so that ids and
+        // percentages can be offset and scaled.
+        operand result;
+        if (lhs.type == rhs.type || rhs.type == value_type::integer) {
+            result.type = lhs.type;
+        }
+        else if (lhs.type == value_type::integer) {
+            result.type = rhs.type;
+        }
+        else if (lhs.known && rhs.known) {
+            log::error(op.file_id(), op.offset(), "A " + describe(lhs.type) + " can not be combined with a " + describe(rhs.type) + ".");
+        }
+        
+        result.known = lhs.known && rhs.known;
+        if (!result.known) {
+            return result;
+        }
+        
+        auto overflow = false;
+        if (op.is_a(kdl::lexer::token::type::plus)) {
+            overflow = __builtin_add_overflow(lhs.number, rhs.number, &result.number);
+        }
+        else if (op.is_a(kdl::lexer::token::type::minus)) {
+            overflow = __builtin_sub_overflow(lhs.number, rhs.number, &result.number);
+        }
+        else if (op.is_a(kdl::lexer::token::type::star)) {
+            overflow = __builtin_mul_overflow(lhs.number, rhs.number, &result.number);
+        }
+        else {
+            if (rhs.number == 0) {
+                log::error(op.file_id(), op.offset(), "The expression divides by zero.");
+            }
+            overflow = (lhs.number == INT64_MIN && rhs.number == -1);
+            result.number = overflow ? 0 : lhs.number / rhs.number;
+        }
+        
+        if (overflow) {
+            log::error(op.file_id(), op.offset(), "The expression overflows.");
+        }
+        return result;
+    }
+    
+private:
+    Stream& m_stream;
+    constant_table *m_constants;
+    bool m_in_list;
+    long m_depth { 0 };
+    kdl::lexer::token m_last;
+};
+
+/**
+ * Evaluate the text of an expression value, which is lexed again from the source buffer
+ * that it was given in.
+ */
+value evaluate(kdl::source_manager::file_id file, std::string_view text, constant_table& constants)
+{
+    auto source = kdl::source_manager::shared().contents(file);
+    auto begin = static_cast<uint32_t>(text.data() - source.data());
+    auto end = begin + static_cast<uint32_t>(text.size());
+    
+    kdl::lexer lexer(file, begin);
+    std::vector<kdl::lexer::token> tokens;
+    kdl::lexer::token tk;
+    while (lexer.next(tk) && tk.lexeme_begin() < end) {
+        tokens.push_back(tk);
+    }
+    
+    token_cursor cursor(tokens);
+    auto result = evaluator<token_cursor>(cursor, &constants, false).sum();
+    return value(result.type, result.number);
+}
+
+// MARK: - Constant Table
+
+constant_table::constant_table(const std::vector<kdk::target::constant>& constants)
+    : m_constants(constants), m_states(constants.size(), state::pending)
+{
+    for (std::size_t n = 0; n < constants.size(); ++n) {
+        m_names.emplace(constants[n].name, n);
+        m_values.push_back(constants[n].value);
+    }
+}
+
+value constant_table::named(const kdl::lexer::token& name)
+{
+    auto it = m_names.find(name.atom());
+    if (it == m_names.end()) {
+        log::error(name.file_id(), name.offset(), "The constant '" + std::string(name.text()) + "' is not defined.");
+    }
+    return fold(it->second);
+}
+
+std::optional<value> constant_table::find(kdk::atom name)
+{
+    auto it = m_names.find(name);
+    if (it == m_names.end()) {
+        return {};
+    }
+    return fold(it->second);
+}
+
+void constant_table::fold_all()
+{
+    for (std::size_t n = 0; n < m_constants.size(); ++n) {
+        fold(n);
+    }
+}
+
+value constant_table::fold(std::size_t n)
+{
+    if (m_states[n] == state::folding) {
+        log::error(m_constants[n].file, m_constants[n].offset, "The constant '" + m_constants[n].name.str() + "' is defined in terms of itself.");
+    }
+    if (m_states[n] == state::pending) {
+        m_states[n] = state::folding;
+        if (m_values[n].type() == value_type::expression) {
+            m_values[n] = evaluate(m_constants[n].file, m_values[n].text(), *this);
+        }
+        m_states[n] = state::folded;
+    }
+    return m_values[n];
+}
+
+};
+
+// MARK: - Parser
+
+bool kdl::expression::test(kdl::sema *sema)
+{
+    if (sema->expect<is<lexer::token::type::lparen, lexer::token::type::minus>>()) {
+        return true;
+    }
+    return sema->expect<
+        is<lexer::token::type::integer, lexer::token::type::percentage, lexer::token::type::resource_id, lexer::token::type::identifier>,
+        is<lexer::token::type::plus, lexer::token::type::minus, lexer::token::type::star, lexer::token::type::slash>
+    >();
+}
+
+kdk::resource::field::value kdl::expression::parse(kdl::sema *sema, bool in_list)
+{
+    // Constants can not be known until every file has been parsed, so any expression that
+    // names one is kept as source text.
+    auto first = sema->peek();
+    evaluator<kdl::sema> expression(*sema, nullptr, in_list);
+    auto result = expression.sum();
+    
+    if (result.known) {
+        return value(result.type, result.number);
+    }
+    
+    auto begin = first.lexeme_begin();
+    auto text = first.text().data() - (first.offset() - begin);
+    return value(value_type::expression, std::string_view(text, expression.last().lexeme_end() - begin));
+}
+
+// MARK: - Folding
+
+namespace
+{
+
+/**
+ * Fold a single field value, if it is an expression or names a constant.
+ */
+void fold_value(constant_table& constants, const kdk::resource::field& field, value& v)
+{
+    if (v.type() == value_type::expression) {
+        v = evaluate(field.source_file(), v.text(), constants);
+    }
+    else if (v.type() == value_type::identifier) {
+        if (auto constant = constants.find(v.atom())) {
+            v = *constant;
+        }
+    }
+}
+
+};
+
+void kdl::expression::fold(kdk::target& target)
+{
+    constant_table constants(target.constants());
+    constants.fold_all();
+    
+    target.update_values([&] (const kdk::resource::field& field, value& v) {
+        fold_value(constants, field, v);
+    });
+}
+
+std::vector<kdk::target::constant> kdl::expression::fold_constants(const std::vector<kdk::target::constant>& constants)
+{
+    constant_table table(constants);
+    auto folded = constants;
+    for (auto& constant : folded) {
+        constant.value = *table.find(constant.name);
+    }
+    return folded;
+}
+
+void kdl::expression::fold(const std::vector<kdk::target::constant>& constants, std::vector<kdk::resource>& resources)
+{
+    constant_table table(constants);
+    for (auto& resource : resources) {
+        // The resources of a range share their fields with the first resource of the range.
+        if (resource.range() && resource.id() != resource.range()->first) {
+            continue;
+        }
+        
+        for (auto& field : resource.fields()) {
+            for (auto& v : field.values()) {
+                fold_value(table, field, v);
+            }
+        }
+    }
+}
@@ -0,0 +1,88 @@
+/*
+* Copyright (c) 2019 Tom Hancocks
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <string_view>
+#include "kdl/lexer.hpp"
+#include "kdl/sema.hpp"
+#include "structures/resource.hpp"
+#include "structures/target.hpp"
+
+#if !defined(KDL_EXPRESSION)
+#define KDL_EXPRESSION
+
+namespace kdl
+{
+
+/**
+ * Expressions allow the value of a field, or of a constant, to be computed from integers,
+ * percentages, resource ids and named constants, using the arithmetic operators and
+ * parentheses.
+ *
+ *  mass = (STRENGTH * 3) / 2;
+ *
+ * Expressions made up only of literals are folded as they are parsed. Expressions that
+ * refer to constants are folded once every file has been parsed, as a constant may be
+ * defined anywhere in the target, including in another file.
+ */
+struct expression
+{
+public:
+    /**
+     * Check for the presence of an expression, rather than a single value.
+     */
+    static bool test(kdl::sema *sema);
+    
+    /**
+     * Parse an expression, returning the value that it folds to. An expression that refers
+     * to constants is returned as an expression value, to be folded by `fold`.
+     *
+     * When the expression is one of a list of values, such as those of a field, a '-' that
+     * has whitespace before it but none after it starts the next value of the list, rather
+     * than subtracting. So `10 -5` is two values, while `10 - 5` and `10-5` are both `5`.
+     * This does not apply inside of parentheses.
+     */
+    static kdk::resource::field::value parse(kdl::sema *sema, bool in_list = false);
+    
+    /**
+     * Fold every expression value in the target, along with any identifier value that names
+     * a constant, in to the value that it represents. Constants that are not defined, or
+     * that are defined in terms of themselves, are reported as errors.
+     */
+    static void fold(kdk::target& target);
+    
+    /**
+     * Fold the value of each of the specified constants, reporting any that can not be
+     * folded, and return the folded constants.
+     */
+    static std::vector<kdk::target::constant> fold_constants(const std::vector<kdk::target::constant>& constants);
+    
+    /**
+     * Fold the expression values of the specified resources, and any identifier value that
+     * names a constant, using the specified constants. Only the constants that are used are
+     * folded, so errors in the others are not reported.
+     */
+    static void fold(const std::vector<kdk::target::constant>& constants, std::vector<kdk::resource>& resources);
+};
+
+};
+
+#endif
@@ -0,0 +1,221 @@
+/*
+* Copyright (c) 2019 Tom Hancocks
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <cerrno>
+#include <stdexcept>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "kdl/source_manager.hpp"
+#include "kdl/scanner.hpp"
+#include "diagnostic/log.hpp"
+
+// MARK: - Shared Instance
+
+kdl::source_manager& kdl::source_manager::shared()
+{
+    static kdl::source_manager manager;
+    return manager;
+}
+
+// MARK: - Buffer
+
+kdl::source_manager::buffer::buffer(const std::string& path, std::string contents)
+    : m_path(path), m_storage(std::move(contents))
+{
+    
+}
+
+kdl::source_manager::buffer::buffer(const std::string& path, const char *mapping, std::size_t size)
+    : m_path(path), m_mapping(mapping), m_mapping_size(size)
+{
+    
+}
+
+kdl::source_manager::buffer::~buffer()
+{
+    if (m_mapping) {
+        munmap(const_cast<char *>(m_mapping), m_mapping_size);
+    }
+}
+
+const std::string& kdl::source_manager::buffer::path() const
+{
+    return m_path;
+}
+
+std::string_view kdl::source_manager::buffer::contents() const
+{
+    if (m_mapping) {
+        return std::string_view(m_mapping, m_mapping_size);
+    }
+    return m_storage;
+}
+
+void kdl::source_manager::buffer::replace(uint32_t offset, uint32_t length, std::string_view text)
+{
+    // Any existing line table no longer describes the contents.
+    {
+        std::lock_guard<std::mutex> lock(m_lines_lock);
+        m_line_starts.clear();
+    }
+    
+    if (!m_mapping) {
+        m_storage.replace(offset, length, text);
+        return;
+    }
+    
+    // The mapping of the original source file can not be edited, so move the contents on to
+    // the heap, leaving some room for the buffer to grow in place over subsequent edits.
+    auto old = contents();
+    std::string storage;
+    storage.reserve(old.size() - length + text.size() + old.size() / 8);
+    storage.append(old.substr(0, offset));
+    storage.append(text);
+    storage.append(old.substr(offset + length));
+    
+    munmap(const_cast<char *>(m_mapping), m_mapping_size);
+    m_mapping = nullptr;
+    m_mapping_size = 0;
+    m_storage = std::move(storage);
+}
+
+kdl::source_manager::location kdl::source_manager::buffer::locate(uint32_t offset) const
+{
+    std::lock_guard<std::mutex> lock(m_lines_lock);
+    
+    if (m_line_starts.empty()) {
+        auto source = contents();
+        m_line_starts.push_back(0);
+        kdl::scanner::line_starts(source.data(), source.data() + source.size(), m_line_starts);
+    }
+    
+    // Find the last line that starts at or before the offset.
+    auto line = std::upper_bound(std::begin(m_line_starts), std::end(m_line_starts), offset) - 1;
+    
+    location loc;
+    loc.line = static_cast<uint32_t>(line - std::begin(m_line_starts)) + 1;
+    loc.column = offset - *line + 1;
+    return loc;
+}
+
+// MARK: - Loading
+
+kdl::source_manager::file_id kdl::source_manager::load_file(const std::string& path)
+{
+    auto it = m_paths.find(path);
+    if (it != m_paths.end()) {
+        return it->second;
+    }
+    
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        log::error(path, 0, "Unable to open source file.");
+    }
+    
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        log::error(path, 0, "Unable to determine the size of source file.");
+    }
+    
+    std::unique_ptr<buffer> source;
+    
+    if (S_ISREG(info.st_mode) && info.st_size > 0) {
+        // Map the file privately so that the lexer can scan the page cache directly. The mapping
+        // outlives the file descriptor, and is released when the buffer is destroyed.
+        auto size = static_cast<std::size_t>(info.st_size);
+        auto mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+            madvise(mapping, size, MADV_SEQUENTIAL);
+            source.reset(new buffer(path, static_cast<const char *>(mapping), size));
+        }
+    }
+    
+    if (!source) {
+        // Either this is not a regular file (pipes, character devices, etc) or the mapping
+        // failed. Fall back to reading everything that is available.
+        std::string str;
+        if (S_ISREG(info.st_mode)) {
+            str.reserve(static_cast<std::size_t>(info.st_size));
+        }
+        
+        char chunk[64 * 1024];
+        ssize_t n;
+        while ((n = read(fd, chunk, sizeof(chunk))) != 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            else if (n < 0) {
+                close(fd);
+                log::error(path, 0, "Unable to read source file.");
+            }
+            str.append(chunk, static_cast<std::size_t>(n));
+        }
+        
+        source.reset(new buffer(path, std::move(str)));
+    }
+    
+    close(fd);
+    
+    auto id = static_cast<file_id>(m_buffers.size());
+    m_buffers.push_back(std::move(source));
+    m_paths.emplace(path, id);
+    return id;
+}
+
+kdl::source_manager::file_id kdl::source_manager::add_source(const std::string& path, std::string contents)
+{
+    auto id = static_cast<file_id>(m_buffers.size());
+    m_buffers.emplace_back(new buffer(path, std::move(contents)));
+    return id;
+}
+
+// MARK: - Editing
+
+void kdl::source_manager::replace(kdl::source_manager::file_id id, uint32_t offset, uint32_t length, std::string_view text)
+{
+    auto size = m_buffers[id]->contents().size();
+    if (offset > size || length > size - offset) {
+        throw std::runtime_error("Attempted to replace a range beyond the end of a source buffer.");
+    }
+    m_buffers[id]->replace(offset, length, text);
+}
+
+// MARK: - Accessors
+
+std::string_view kdl::source_manager::contents(kdl::source_manager::file_id id) const
+{
+    return m_buffers[id]->contents();
+}
+
+const std::string& kdl::source_manager::path(kdl::source_manager::file_id id) const
+{
+    return m_buffers[id]->path();
+}
+
+kdl::source_manager::location kdl::source_manager::locate(kdl::source_manager::file_id id, uint32_t offset) const
+{
+    return m_buffers[id]->locate(offset);
+}
@@ -0,0 +1,149 @@
+/*
+* Copyright (c) 2019 Tom Hancocks
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+
+#if !defined(KDL_SOURCE_MANAGER)
+#define KDL_SOURCE_MANAGER
+
+namespace kdl
+{
+
+/**
+ * The source manager owns every source buffer loaded during a compile. Buffers
+ * are kept alive until the process ends, which allows tokens and other
+ * structures to refer to source text through lightweight spans rather than
+ * owning copies of it. The only exception is a buffer that is edited through
+ * `replace`, whose spans must be relocated by their owner.
+ *
+ * Each buffer is identified by a small integer id, which is cheap to store and
+ * compare, and can be resolved back to the path and contents of the source.
+ */
+class source_manager
+{
+public:
+    typedef uint32_t file_id;
+    
+    /**
+     * A file id that does not refer to any source buffer.
+     */
+    static constexpr file_id invalid_file = UINT32_MAX;
+    
+    /**
+     * A line and column within a source buffer, both numbered from 1.
+     */
+    struct location
+    {
+        uint32_t line { 0 };
+        uint32_t column { 0 };
+    };
+    
+public:
+    /**
+     * Returns the source manager for the current compile.
+     */
+    static kdl::source_manager& shared();
+    
+    /**
+     * Load the file at the specified path. Loading the same path more than once
+     * returns the id of the existing buffer.
+     *
+     * Regular files are mapped directly into memory, rather than being read into
+     * a heap buffer. Pipes and other non-regular files are read in their entirety.
+     */
+    file_id load_file(const std::string& path);
+    
+    /**
+     * Add a source buffer with the specified contents, to be reported under the
+     * specified path.
+     */
+    file_id add_source(const std::string& path, std::string contents);
+    
+    /**
+     * Replace a range of the contents of the specified source buffer with new text.
+     * Any spans referring to the previous contents of the buffer are invalidated. The
+     * buffer is edited in place where possible, in which case text ahead of the edited
+     * range does not move.
+     */
+    void replace(file_id id, uint32_t offset, uint32_t length, std::string_view text);
+    
+    /**
+     * Returns the contents of the specified source buffer.
+     */
+    std::string_view contents(file_id id) const;
+    
+    /**
+     * Returns the path of the specified source buffer.
+     */
+    const std::string& path(file_id id) const;
+    
+    /**
+     * Returns the line and column of the specified byte offset in a source buffer.
+     *
+     * The table of line starts for a buffer is only built the first time that it is
+     * needed, in a single pass over the buffer. Nothing else in the compile needs to know
+     * about lines, so this is only ever paid for when a diagnostic is reported.
+     */
+    location locate(file_id id, uint32_t offset) const;
+    
+private:
+    /**
+     * A single source buffer. The contents are either backed by a private memory
+     * mapping of the source file, or by heap storage owned by the buffer.
+     */
+    class buffer
+    {
+    public:
+        buffer(const std::string& path, std::string contents);
+        buffer(const std::string& path, const char *mapping, std::size_t size);
+        ~buffer();
+        
+        buffer(const buffer&) = delete;
+        buffer& operator=(const buffer&) = delete;
+        
+        const std::string& path() const;
+        std::string_view contents() const;
+        void replace(uint32_t offset, uint32_t length, std::string_view text);
+        location locate(uint32_t offset) const;
+        
+    private:
+        std::string m_path;
+        std::string m_storage;
+        const char *m_mapping { nullptr };
+        std::size_t m_mapping_size { 0 };
+        mutable std::mutex m_lines_lock;
+        mutable std::vector<uint32_t> m_line_starts;
+    };
+    
+    std::vector<std::unique_ptr<buffer>> m_buffers;
+    std::unordered_map<std::string, file_id> m_paths;
+};
+
+};
+
+#endif
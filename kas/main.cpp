@@ -21,10 +21,17 @@
 */
 
 #include <string>
+#include <vector>
 #include <iostream>
 #include <algorithm>
+#include <cctype>
+#include <climits>
+#include <stdexcept>
 #include "kdl/lexer.hpp"
 #include "kdl/sema.hpp"
+#include "kdl/importer.hpp"
+#include "diagnostic/log.hpp"
+#include "version.hpp"
 
 // MARK: - Command Line Helpers
 
@@ -36,12 +43,52 @@ bool option_exists(const char **begin, const char **end, const std::string& opti
 const char *get_option(const char **begin, const char **end, const std::string& option)
 {
     const char **i = std::find(begin, end, option);
-    if (i != end && ++i != end) {
-        return *i;
+    if (i != end && i + 1 < end) {
+        return *(i + 1);
     }
     return nullptr;
 }
 
+/**
+ * Returns the value given to an option that must have one. An option given as the last
+ * argument, without a value, is reported as an error against its position.
+ */
+const char *require_option(const char **begin, const char **end, const std::string& option)
+{
+    auto value = get_option(begin, end, option);
+    if (!value) {
+        auto position = static_cast<int>(std::find(begin, end, option) - begin);
+        log::error("<arguments>", position, "The '" + option + "' option must be followed by a value.");
+    }
+    return value;
+}
+
+/**
+ * Returns the value given to an option as a count. Anything other than a whole number
+ * that fits in an unsigned integer is reported as an error.
+ */
+unsigned get_count(const char **begin, const char **end, const std::string& option)
+{
+    auto value = require_option(begin, end, option);
+    std::size_t length = 0;
+    unsigned long count = 0;
+    
+    if (std::isdigit(static_cast<unsigned char>(value[0]))) {
+        try {
+            count = std::stoul(value, &length);
+        }
+        catch (const std::out_of_range&) {
+            length = 0;
+        }
+    }
+    
+    if (length == 0 || value[length] != '\0' || count > UINT_MAX) {
+        auto position = static_cast<int>(std::find(begin, end, option) - begin) + 1;
+        log::error("<arguments>", position, "The '" + option + "' option must be given a whole number, not '" + std::string(value) + "'.");
+    }
+    return static_cast<unsigned>(count);
+}
+
 // MARK: - Entry Point
 
 int main(int argc, const char **argv)
@@ -49,39 +96,87 @@ int main(int argc, const char **argv)
     
     // Check if any arguments have been supplied.
     if (option_exists(argv, argv + argc, "--help") || option_exists(argv, argv + argc, "-h")) {
-        std::cout   << "The Kestrel Assembler -- Version 0.1" << std::endl
+        std::cout   << "The Kestrel Assembler -- Version " KAS_VERSION << std::endl
                     << "    kas [options] -f input_file" << std::endl << std::endl
                     << "Options" << std::endl
                     << "  -f,               The KDL source file to assemble." << std::endl
                     << "  -o                The destination KDAT file for the assembled data file to be written to." << std::endl
+                    << "  -j                The number of threads to use. Defaults to 1, or 0 to use all available." << std::endl
+                    << "  -c                A directory in which to cache parsed source files between builds." << std::endl
+                    << "  -v                A comma separated list of variants to build. Each variant is written" << std::endl
+                    << "                    alongside the destination file, with the name of the variant appended." << std::endl
                     << "  -h, --help        Display this help message." << std::endl;
         return 0;
     }
     
     std::string input_file { "" };
     if (option_exists(argv, argv + argc, "-f")) {
-        input_file = get_option(argv, argv + argc, "-f");
+        input_file = require_option(argv, argv + argc, "-f");
     }
     
     std::string output_file { "kestrel-plugin.kdat" };
     if (option_exists(argv, argv + argc, "-o")) {
-        output_file = get_option(argv, argv + argc, "-o");
+        output_file = require_option(argv, argv + argc, "-o");
     }
     
     
+    unsigned jobs = 1;
+    if (option_exists(argv, argv + argc, "-j")) {
+        jobs = get_option(argv, argv + argc, "-j") ? get_count(argv, argv + argc, "-j") : 0;
+    }
+    
+    std::string cache_directory { "" };
+    if (option_exists(argv, argv + argc, "-c")) {
+        cache_directory = require_option(argv, argv + argc, "-c");
+    }
+    
+    std::vector<std::string> variant_names;
+    if (option_exists(argv, argv + argc, "-v")) {
+        std::string list { require_option(argv, argv + argc, "-v") };
+        for (std::size_t start = 0, end = 0; start <= list.size(); start = end + 1) {
+            end = std::min(list.find(',', start), list.size());
+            if (end > start) {
+                variant_names.push_back(list.substr(start, end - start));
+            }
+        }
+    }
+    
     if (argc <= 1 || input_file.empty()) {
         std::cout << "kas: \x1b[31merror: \x1b[0mno input file" << std::endl;
         return 1;
     }   
     
-    // Perform the workflow (lexical analysis, semantic analysis...)
-    auto lexer = kdl::lexer::open_file(input_file);
-    auto sema = kdl::sema(kdk::target(output_file), lexer.analyze());
-    sema.run();
+    // Perform the workflow (lexical analysis, semantic analysis...) across the input file
+    // and every file that it imports. Any source file that is unchanged since it was last
+    // cached has its resources read straight from the cache, and is neither lexed nor parsed.
+    auto file = kdl::source_manager::shared().load_file(input_file);
+    kdk::target target(output_file);
+    kdl::importer(jobs, cache_directory).run(file, target);
     
     // The semantic analysis should have resulted in a completed target structure, which
     // can now be assembled.
-    sema.target().build();
+    if (variant_names.empty()) {
+        target.build(jobs);
+        return 0;
+    }
+    
+    // Each variant is written next to the destination file, as `name-variant.kdat`.
+    auto extension = output_file.find_last_of('.');
+    if (extension == std::string::npos || output_file.find('/', extension) != std::string::npos) {
+        extension = output_file.size();
+    }
+    
+    std::vector<kdk::target::variant> variants;
+    for (const auto& name : variant_names) {
+        kdk::atom variant { name };
+        const auto& declared = target.variants();
+        if (std::find(std::begin(declared), std::end(declared), variant) == std::end(declared)) {
+            std::cout << "kas: \x1b[31merror: \x1b[0munknown variant '" << name << "'" << std::endl;
+            return 1;
+        }
+        variants.push_back({ variant, output_file.substr(0, extension) + "-" + name + output_file.substr(extension) });
+    }
+    target.build(variants, jobs);
     
     return 0;
 }
@@ -186,12 +186,12 @@ void rsrc::data::write_cstr(const std::string& str, size_t size)
     write_data(bytes);
 }
 
-void rsrc::data::write_data(const rsrc::data data)
+void rsrc::data::write_data(const rsrc::data& data)
 {
     write_data(data.m_data);
 }
 
-void rsrc::data::write_data(const std::vector<uint8_t> bytes)
+void rsrc::data::write_data(const std::vector<uint8_t>& bytes)
 {
     if (m_ptr >= size()) {
         m_data.insert(m_data.end(), bytes.begin(), bytes.end());
@@ -210,6 +210,11 @@ void rsrc::data::pad_to_size(int64_t size)
     }
 }
 
+void rsrc::data::reserve(uint64_t size)
+{
+    m_data.reserve(size);
+}
+
 // MARK: - Accessors
 
 uint64_t rsrc::data::size() const
@@ -24,6 +24,8 @@
 #include <sys/types.h>
 #include <vector>
 #include <type_traits>
+#include <memory>
+#include <string>
 
 #if !defined(RSRC_DATA)
 #define RSRC_DATA
@@ -93,18 +95,24 @@ public:
     /**
      * Write another data object into the data.
      */
-    void write_data(const rsrc::data data);
+    void write_data(const rsrc::data& data);
     
     /**
      * Write a sequence of bytes into the data.
      */
-    void write_data(const std::vector<uint8_t> bytes);
+    void write_data(const std::vector<uint8_t>& bytes);
     
     /**
      * Write zero bytes to the data until the specified size is reached.
      */
     void pad_to_size(int64_t size);
     
+    /**
+     * Reserve storage for the data to grow to the specified size, without changing the
+     * current size of the data.
+     */
+    void reserve(uint64_t size);
+    
     /**
      * Returns the current size of the data in bytes.
      */
@@ -43,7 +43,7 @@ std::shared_ptr<rsrc::file> rsrc::file::create(const std::string path)
 
 // MARK: - Resource Management
 
-std::shared_ptr<rsrc::file::resource> rsrc::file::add_resource(const std::string type, int64_t id, const std::string name, rsrc::data data)
+std::shared_ptr<rsrc::file::resource> rsrc::file::add_resource(const std::string& type, int64_t id, std::string name, std::shared_ptr<const rsrc::data> data)
 {
     // Get the container
     auto container = get_type_container(type);
@@ -52,15 +52,15 @@ std::shared_ptr<rsrc::file::resource> rsrc::file::add_resource(const std::string
     }
     
     // Add the resource...
-    auto resource = rsrc::file::resource::create(id, name, data);
+    auto resource = rsrc::file::resource::create(id, std::move(name), std::move(data));
     container->add_resource(resource);
     return resource;
 }
 
-std::shared_ptr<rsrc::file::type_container> rsrc::file::get_type_container(const std::string type_code)
+std::shared_ptr<rsrc::file::type_container> rsrc::file::get_type_container(const std::string& type_code)
 {
     // Try and find the container first...
-    for (auto container : m_containers) {
+    for (const auto& container : m_containers) {
         if (container->type_code() == type_code) {
             return container;
         }
@@ -75,15 +75,15 @@ std::shared_ptr<rsrc::file::type_container> rsrc::file::get_type_container(const
 
 // MARK: - Resource
 
-rsrc::file::resource::resource(int64_t id, const std::string name, rsrc::data blob)
-    : m_id(id), m_name(name), m_blob(blob)
+rsrc::file::resource::resource(int64_t id, std::string name, std::shared_ptr<const rsrc::data> blob)
+    : m_id(id), m_name(std::move(name)), m_blob(std::move(blob))
 {
     
 }
 
-std::shared_ptr<rsrc::file::resource> rsrc::file::resource::create(int64_t id, const std::string name, rsrc::data blob)
+std::shared_ptr<rsrc::file::resource> rsrc::file::resource::create(int64_t id, std::string name, std::shared_ptr<const rsrc::data> blob)
 {
-    return std::make_shared<rsrc::file::resource>(id, name, blob);
+    return std::make_shared<rsrc::file::resource>(id, std::move(name), std::move(blob));
 }
 
 int64_t rsrc::file::resource::id() const
@@ -91,14 +91,14 @@ int64_t rsrc::file::resource::id() const
     return m_id;
 }
 
-std::string rsrc::file::resource::name() const
+const std::string& rsrc::file::resource::name() const
 {
     return m_name;
 }
 
-rsrc::data rsrc::file::resource::blob() const
+const rsrc::data& rsrc::file::resource::blob() const
 {
-    return m_blob;
+    return *m_blob;
 }
 
 void rsrc::file::resource::set_data_offset(uint64_t offset)
@@ -126,15 +126,15 @@ std::shared_ptr<rsrc::file::type_container> rsrc::file::type_container::create(c
 
 void rsrc::file::type_container::add_resource(std::shared_ptr<rsrc::file::resource> resource)
 {
-    m_resources.push_back(resource);
+    m_resources.push_back(std::move(resource));
 }
 
-std::string rsrc::file::type_container::type_code() const
+const std::string& rsrc::file::type_container::type_code() const
 {
     return m_code;
 }
 
-std::vector<std::shared_ptr<rsrc::file::resource>> rsrc::file::type_container::resources() const
+const std::vector<std::shared_ptr<rsrc::file::resource>>& rsrc::file::type_container::resources() const
 {
     return m_resources;
 }
@@ -182,10 +182,10 @@ rsrc::data rsrc::file::write_extended()
     // Iterate through all of the resources and write their data blobs to the file data.
     // When doing this we need to record the starting points of each resources data, as
     // they will be needing later.
-    for (auto container : m_containers) {
-        for (auto resource : container->resources()) {
+    for (const auto& container : m_containers) {
+        for (const auto& resource : container->resources()) {
             // Get the data for the resource and determine its size.
-            auto data = resource->blob();
+            const auto& data = resource->blob();
             auto size = data.size();
             resource->set_data_offset(fork_data.size());
             fork_data.write_quad(size);
@@ -226,12 +226,12 @@ rsrc::data rsrc::file::write_standard()
     // When doing this we need to record the starting points of each resources data, as
     
     uint16_t resource_count = 0;
-    for (auto container : m_containers) {
+    for (const auto& container : m_containers) {
         resource_count += container->resources().size();
         
-        for (auto resource : container->resources()) {
+        for (const auto& resource : container->resources()) {
             // Get the data for the resource and determine its size.
-            auto data = resource->blob();
+            const auto& data = resource->blob();
             auto size = data.size();
             resource->set_data_offset(fork_data.size() - data_offset);
             fork_data.write_long(static_cast<uint32_t>(size));
@@ -269,7 +269,7 @@ rsrc::data rsrc::file::write_standard()
     // Now moving on to actually writing each of the type descriptors into the data.
     uint16_t resource_offset = sizeof(uint16_t) + (m_containers.size() * resource_type_length);
     fork_data.write_word(m_containers.size() - 1);
-    for (auto container : m_containers) {
+    for (const auto& container : m_containers) {
         // We need to ensure that the type code is 4 characters -- otherwise this file will be
         // massively corrupt when produced.
         auto mac_roman = rsrc::mac_roman::from_str(container->type_code());
@@ -285,8 +285,8 @@ rsrc::data rsrc::file::write_standard()
     
     // Now we're writing the actual resource headers.
     uint16_t name_offset = 0;
-    for (auto container : m_containers) {
-        for (auto resource : container->resources()) {
+    for (const auto& container : m_containers) {
+        for (const auto& resource : container->resources()) {
             
             fork_data.write_signed_word(static_cast<int16_t>(resource->id()));
             
@@ -299,7 +299,7 @@ rsrc::data rsrc::file::write_standard()
             else {
                 // Convert the name to MacRoman so that we can get the length of it when encoded.
                 auto mac_roman = rsrc::mac_roman::from_str(resource->name());
-                std::vector<uint8_t> bytes = mac_roman.bytes();
+                const auto& bytes = mac_roman.bytes();
                 uint16_t len = bytes.size();
                 
                 fork_data.write_word(name_offset);
@@ -323,14 +323,14 @@ rsrc::data rsrc::file::write_standard()
     }
     
     // Finally we write out each of the resource names, and calculate the map length.
-    for (auto container : m_containers) {
-        for (auto resource : container->resources()) {
+    for (const auto& container : m_containers) {
+        for (const auto& resource : container->resources()) {
             if (resource->name().empty()) {
                 continue;
             }
             
             auto mac_roman = rsrc::mac_roman::from_str(resource->name());
-            std::vector<uint8_t> bytes = mac_roman.bytes();
+            const auto& bytes = mac_roman.bytes();
             auto len = bytes.size();
             len = len >= 0x100 ? 0xFF : len;
             
@@ -56,7 +56,8 @@ public:
      *
      * Resource objects represent actual resource data in the resource file. They
      * contain the actual binary blob data, name, ID and attributes of the
-     * resource.
+     * resource. The blob is shared rather than copied, so that several resources, or
+     * several files, can hold the same data.
      */
     struct resource
     {
@@ -64,12 +65,12 @@ public:
         /**
          * Construct a new resource object.
          */
-        resource(int64_t id, const std::string name, rsrc::data blob);
+        resource(int64_t id, std::string name, std::shared_ptr<const rsrc::data> blob);
         
         /**
          * Create a new shared resource object.
          */
-        static std::shared_ptr<rsrc::file::resource> create(int64_t id, const std::string name, rsrc::data blob);
+        static std::shared_ptr<rsrc::file::resource> create(int64_t id, std::string name, std::shared_ptr<const rsrc::data> blob);
         
         /**
          * Returns the resource id.
@@ -79,12 +80,12 @@ public:
         /**
          * Returns the resource name.
          */
-        std::string name() const;
+        const std::string& name() const;
         
         /**
          * Returns the binary data contents of the resource.
          */
-        rsrc::data blob() const;
+        const rsrc::data& blob() const;
         
         /**
          * Set the offset of the resource data within the file it is being written to.
@@ -99,7 +100,7 @@ public:
     private:
         int64_t m_id;
         std::string m_name;
-        rsrc::data m_blob;
+        std::shared_ptr<const rsrc::data> m_blob;
         uint64_t m_data_offset;
     };
     
@@ -131,12 +132,12 @@ public:
         /**
          * Return the type code of the container.
          */
-        std::string type_code() const;
+        const std::string& type_code() const;
         
         /**
          * Returns a vector containing shared pointers to each of its resources.
          */
-        std::vector<std::shared_ptr<rsrc::file::resource>> resources() const;
+        const std::vector<std::shared_ptr<rsrc::file::resource>>& resources() const;
         
     private:
         std::string m_code;
@@ -161,14 +162,15 @@ public:
     static std::shared_ptr<rsrc::file> create(const std::string path);
     
     /**
-     * Add a new resource to the file.
+     * Add a new resource to the file. The data is shared with the resource, and is not
+     * copied.
      */
-    std::shared_ptr<rsrc::file::resource> add_resource(const std::string type_code, int64_t id, const std::string name, rsrc::data data);
+    std::shared_ptr<rsrc::file::resource> add_resource(const std::string& type_code, int64_t id, std::string name, std::shared_ptr<const rsrc::data> data);
     
     /**
      * Find or create the specified type container.
      */
-    std::shared_ptr<rsrc::file::type_container> get_type_container(const std::string type_code);
+    std::shared_ptr<rsrc::file::type_container> get_type_container(const std::string& type_code);
     
     /**
      * Write the Resource File to disk.
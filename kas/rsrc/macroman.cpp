@@ -21,6 +21,7 @@
 */
 
 #include <cstdint>
+#include <cstring>
 #include <iostream>
 #include "rsrc/macroman.hpp"
 
@@ -204,7 +205,7 @@ std::string rsrc::mac_roman::to_str() const
 
 // MARK: - Accessors
 
-std::vector<uint8_t> rsrc::mac_roman::bytes() const
+const std::vector<uint8_t>& rsrc::mac_roman::bytes() const
 {
     return m_bytes;
 }
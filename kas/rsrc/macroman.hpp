@@ -39,7 +39,7 @@ public:
     static mac_roman from_str(const std::string& str);
     
     std::string to_str() const;
-    std::vector<uint8_t> bytes() const;
+    const std::vector<uint8_t>& bytes() const;
     
 private:
     std::vector<uint8_t> m_bytes;
@@ -0,0 +1,50 @@
+/*
+* Copyright (c) 2019 Tom Hancocks
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <cstdint>
+#include <algorithm>
+#include "structures/arena.hpp"
+
+// MARK: - Allocation
+
+void *kdk::arena::allocate(std::size_t size, std::size_t alignment)
+{
+    auto address = reinterpret_cast<std::uintptr_t>(m_ptr);
+    auto padding = (alignment - (address % alignment)) % alignment;
+    
+    if (!m_ptr || padding + size > static_cast<std::size_t>(m_end - m_ptr)) {
+        // Start a new block. Requests that are larger than a whole block get a block of
+        // their own, and the block size continues to grow up to its limit.
+        auto block_size = std::max(m_block_size, size + alignment);
+        m_blocks.emplace_back(new char[block_size]);
+        m_ptr = m_blocks.back().get();
+        m_end = m_ptr + block_size;
+        m_block_size = std::min(m_block_size * 2, maximum_block_size);
+        
+        address = reinterpret_cast<std::uintptr_t>(m_ptr);
+        padding = (alignment - (address % alignment)) % alignment;
+    }
+    
+    auto result = m_ptr + padding;
+    m_ptr = result + size;
+    return result;
+}
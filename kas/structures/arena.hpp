@@ -0,0 +1,109 @@
+/*
+* Copyright (c) 2019 Tom Hancocks
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+#if !defined(KDK_ARENA)
+#define KDK_ARENA
+
+namespace kdk
+{
+
+/**
+ * A non-owning view of a contiguous run of objects, typically allocated from an arena.
+ */
+template<typename T>
+class span
+{
+public:
+    span() = default;
+    span(T *data, std::size_t size) : m_data(data), m_size(size) {}
+    
+    T *data() const { return m_data; }
+    std::size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    
+    T *begin() const { return m_data; }
+    T *end() const { return m_data + m_size; }
+    
+    T& operator[](std::size_t n) const { return m_data[n]; }
+    
+private:
+    T *m_data { nullptr };
+    std::size_t m_size { 0 };
+};
+
+/**
+ * A monotonic allocator that holds the parsed model of a compilation. Memory is taken
+ * from large blocks by bumping a pointer, and is never released individually. Instead
+ * everything allocated from the arena is freed in one operation when the arena is
+ * destroyed, and so only trivially destructible objects may be placed in it.
+ *
+ * Blocks start small and double in size as the arena grows, so that arenas holding
+ * only a handful of objects remain cheap.
+ */
+class arena
+{
+public:
+    arena() = default;
+    arena(const arena&) = delete;
+    arena& operator=(const arena&) = delete;
+    
+    /**
+     * Allocate uninitialised storage of the specified size and alignment.
+     */
+    void *allocate(std::size_t size, std::size_t alignment);
+    
+    /**
+     * Copy a run of objects in to the arena, returning a span over the copies.
+     */
+    template<typename T>
+    span<T> copy(const T *first, std::size_t count)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "Objects in an arena are never destroyed.");
+        if (count == 0) {
+            return span<T>();
+        }
+        auto storage = static_cast<T *>(allocate(sizeof(T) * count, alignof(T)));
+        for (std::size_t n = 0; n < count; ++n) {
+            new (storage + n) T(first[n]);
+        }
+        return span<T>(storage, count);
+    }
+    
+private:
+    static constexpr std::size_t initial_block_size { 4 * 1024 };
+    static constexpr std::size_t maximum_block_size { 1024 * 1024 };
+    
+    std::vector<std::unique_ptr<char[]>> m_blocks;
+    char *m_ptr { nullptr };
+    char *m_end { nullptr };
+    std::size_t m_block_size { initial_block_size };
+};
+
+};
+
+#endif
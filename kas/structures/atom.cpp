@@ -0,0 +1,143 @@
+/*
+* Copyright (c) 2019 Tom Hancocks
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include "structures/atom.hpp"
+
+// MARK: - Interner
+
+namespace
+{
+
+/**
+ * The table of every string that has been interned. Strings are held in a deque so that
+ * they never move once added, which allows views of them to be handed out freely.
+ */
+class interner
+{
+public:
+    interner()
+    {
+        m_texts.emplace_back();
+        m_ids.emplace(m_texts.back(), 0);
+    }
+    
+    uint32_t intern(std::string_view text)
+    {
+        {
+            std::shared_lock<std::shared_mutex> lock(m_lock);
+            auto it = m_ids.find(text);
+            if (it != m_ids.end()) {
+                return it->second;
+            }
+        }
+        
+        std::unique_lock<std::shared_mutex> lock(m_lock);
+        auto it = m_ids.find(text);
+        if (it != m_ids.end()) {
+            return it->second;
+        }
+        
+        auto id = static_cast<uint32_t>(m_texts.size());
+        m_texts.emplace_back(text);
+        m_ids.emplace(m_texts.back(), id);
+        return id;
+    }
+    
+    std::string_view text(uint32_t id) const
+    {
+        std::shared_lock<std::shared_mutex> lock(m_lock);
+        return m_texts[id];
+    }
+    
+private:
+    mutable std::shared_mutex m_lock;
+    std::deque<std::string> m_texts;
+    std::unordered_map<std::string_view, uint32_t> m_ids;
+};
+
+/**
+ * Returns the interner for the process. It is never destroyed, so that atoms remain usable
+ * for as long as the process runs.
+ */
+interner& shared_interner()
+{
+    static auto table = new interner;
+    return *table;
+}
+
+/**
+ * A small direct mapped cache of recently interned strings, private to each thread. The
+ * cached text refers to the interned copy, which never moves.
+ */
+struct cache_entry
+{
+    std::string_view text;
+    uint32_t id { 0 };
+};
+
+constexpr std::size_t cache_size = 256;
+thread_local cache_entry cache[cache_size];
+
+};
+
+// MARK: - Constructor
+
+kdk::atom::atom(std::string_view text)
+{
+    if (text.empty()) {
+        return;
+    }
+    
+    auto& entry = cache[std::hash<std::string_view>()(text) % cache_size];
+    if (entry.id != 0 && entry.text == text) {
+        m_id = entry.id;
+        return;
+    }
+    
+    auto& table = shared_interner();
+    m_id = table.intern(text);
+    entry.text = table.text(m_id);
+    entry.id = m_id;
+}
+
+kdk::atom kdk::atom::with_id(uint32_t id)
+{
+    kdk::atom atom;
+    atom.m_id = id;
+    return atom;
+}
+
+// MARK: - Accessors
+
+std::string_view kdk::atom::text() const
+{
+    return shared_interner().text(m_id);
+}
+
+std::string kdk::atom::str() const
+{
+    return std::string(text());
+}
@@ -0,0 +1,102 @@
+/*
+* Copyright (c) 2019 Tom Hancocks
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <string>
+#include <string_view>
+#include <functional>
+#include <cstdint>
+
+#if !defined(KDK_ATOM)
+#define KDK_ATOM
+
+namespace kdk
+{
+
+/**
+ * An atom is a string that has been interned in to a table shared by the whole process,
+ * and is represented by its 32-bit index in that table. Equal strings always produce the
+ * same atom, so atoms can be compared and hashed as plain integers without ever looking
+ * at the strings themselves. The default atom is the empty string.
+ *
+ * Interning is safe to do from several threads at once. Each thread keeps a small cache of
+ * the atoms it has seen recently, so that the shared table is rarely consulted.
+ */
+class atom
+{
+public:
+    atom() = default;
+    
+    /**
+     * Intern the specified text, returning its atom.
+     */
+    explicit atom(std::string_view text);
+    
+    /**
+     * Returns the atom with the specified index, as previously returned by `id`.
+     */
+    static atom with_id(uint32_t id);
+    
+    /**
+     * Returns the text of the atom. The text remains valid for the lifetime of the process.
+     */
+    std::string_view text() const;
+    
+    /**
+     * Returns a copy of the text of the atom.
+     */
+    std::string str() const;
+    
+    /**
+     * Returns the index of the atom in the table.
+     */
+    uint32_t id() const { return m_id; }
+    
+    /**
+     * Test if the atom is the empty string.
+     */
+    bool empty() const { return m_id == 0; }
+    
+    bool operator==(const atom& other) const { return m_id == other.m_id; }
+    bool operator!=(const atom& other) const { return m_id != other.m_id; }
+    
+private:
+    uint32_t m_id { 0 };
+};
+
+};
+
+namespace std
+{
+
+template<>
+struct hash<kdk::atom>
+{
+    std::size_t operator()(const kdk::atom& atom) const
+    {
+        // Atoms are handed out sequentially, so spread them over the full width.
+        return static_cast<std::size_t>(atom.id()) * 0x9E3779B97F4A7C15ULL;
+    }
+};
+
+};
+
+#endif
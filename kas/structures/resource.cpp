@@ -20,11 +20,61 @@
 * SOFTWARE.
 */
 
+#include <algorithm>
+#include <stdexcept>
+#include <functional>
+#include <vector>
 #include "structures/resource.hpp"
 
+// MARK: - Source Text
+
+namespace
+{
+
+/**
+ * If the text lies within the source range [begin, end), move it to refer to the same text
+ * at destination instead. The source range may no longer be allocated, so it is only ever
+ * compared against and never dereferenced.
+ */
+void relocate(std::string_view& text, const char *begin, const char *end, const char *destination)
+{
+    auto ptr = text.data();
+    std::less<const char *> before;
+    if (ptr && !before(ptr, begin) && before(ptr, end)) {
+        text = std::string_view(destination + (ptr - begin), text.size());
+    }
+}
+
+};
+
+// MARK: - Field Index
+
+namespace
+{
+
+/**
+ * Returns the run of fields with the specified name, using the index of the fields.
+ */
+kdk::span<const kdk::resource::field> find_fields(kdk::span<kdk::resource::field> fields, kdk::span<kdk::resource::field_slot> index, const kdk::atom name)
+{
+    if (index.empty()) {
+        return {};
+    }
+    
+    auto mask = index.size() - 1;
+    for (auto n = std::hash<kdk::atom>()(name) & mask; index[n].count > 0; n = (n + 1) & mask) {
+        if (index[n].name == name) {
+            return kdk::span<const kdk::resource::field>(fields.data() + index[n].first, index[n].count);
+        }
+    }
+    return {};
+}
+
+};
+
 // MARK: - Constructor
 
-kdk::resource::resource(const std::string type, const int64_t id, const std::string name)
+kdk::resource::resource(const kdk::atom type, const int64_t id, const std::string name)
     : m_type(type), m_id(id), m_name(name)
 {
     
@@ -32,32 +82,231 @@ kdk::resource::resource(const std::string type, const int64_t id, const std::str
 
 // MARK: - Field
 
-kdk::resource::field::field(const std::string name, std::vector<std::tuple<std::string, value_type>> values)
-    : m_name(name), m_values(values)
+kdk::resource::field::field(kdk::atom name, kdl::source_manager::file_id file, std::string_view source_text, kdk::span<kdk::resource::field::value> values)
+    : m_name(name), m_file(file), m_source_text(source_text), m_values(values)
 {
     
 }
 
-std::string kdk::resource::field::name() const
+kdk::atom kdk::resource::field::name() const
 {
     return m_name;
 }
 
-std::vector<std::tuple<std::string, kdk::resource::field::value_type>> kdk::resource::field::values() const
+std::string_view kdk::resource::field::source_text() const
+{
+    return m_source_text;
+}
+
+kdl::source_manager::file_id kdk::resource::field::source_file() const
+{
+    return m_file;
+}
+
+uint32_t kdk::resource::field::source_offset() const
+{
+    if (m_file == kdl::source_manager::invalid_file) {
+        return 0;
+    }
+    return static_cast<uint32_t>(m_source_text.data() - kdl::source_manager::shared().contents(m_file).data());
+}
+
+kdk::span<const kdk::resource::field::value> kdk::resource::field::values() const
+{
+    return kdk::span<const kdk::resource::field::value>(m_values.data(), m_values.size());
+}
+
+kdk::span<kdk::resource::field::value> kdk::resource::field::values()
 {
     return m_values;
 }
 
-std::shared_ptr<kdk::resource::field> kdk::resource::field_named(const std::string name, bool required) const
+// MARK: - Field Values
+
+kdk::resource::field::value::value(kdk::resource::field::value_type type, int64_t number)
+    : m_number(number), m_type(type)
+{
+    
+}
+
+kdk::resource::field::value::value(kdk::resource::field::value_type type, std::string_view text)
+    : m_text(text), m_type(type)
+{
+    
+}
+
+kdk::resource::field::value::value(std::string_view text, kdk::atom atom)
+    : m_number(atom.id()), m_text(text), m_type(kdk::resource::field::value_type::identifier)
+{
+    
+}
+
+kdk::resource::field::value_type kdk::resource::field::value::type() const
+{
+    return m_type;
+}
+
+int64_t kdk::resource::field::value::number() const
+{
+    return m_number;
+}
+
+uint32_t kdk::resource::field::value::color() const
+{
+    return static_cast<uint32_t>(m_number);
+}
+
+std::string_view kdk::resource::field::value::text() const
+{
+    return m_text;
+}
+
+kdk::atom kdk::resource::field::value::atom() const
+{
+    return kdk::atom::with_id(static_cast<uint32_t>(m_number));
+}
+
+void kdk::resource::field::value::relocate_text(const char *begin, const char *end, const char *destination)
+{
+    relocate(m_text, begin, end, destination);
+}
+
+void kdk::resource::field::relocate_text(const char *begin, const char *end, const char *destination)
+{
+    relocate(m_source_text, begin, end, destination);
+    
+    for (auto& value : m_values) {
+        value.relocate_text(begin, end, destination);
+    }
+}
+
+// MARK: - Field Lookup
+
+kdk::span<const kdk::resource::field> kdk::resource::fields() const
+{
+    return kdk::span<const kdk::resource::field>(m_fields.data(), m_fields.size());
+}
+
+kdk::span<kdk::resource::field> kdk::resource::fields()
+{
+    return m_fields;
+}
+
+// MARK: - Variants
+
+void kdk::resource::set_variants(kdk::span<kdk::atom> variants)
+{
+    m_variants = variants;
+}
+
+kdk::span<const kdk::atom> kdk::resource::variants() const
+{
+    return kdk::span<const kdk::atom>(m_variants.data(), m_variants.size());
+}
+
+bool kdk::resource::in_variant(const kdk::atom variant) const
 {
-    for (auto f : m_fields) {
-        if (f.name() == name) {
-            return std::make_shared<kdk::resource::field>(f);
+    if (m_variants.empty()) {
+        return true;
+    }
+    return std::find(m_variants.begin(), m_variants.end(), variant) != m_variants.end();
+}
+
+// MARK: - Base Resource
+
+void kdk::resource::set_base_id(int64_t id)
+{
+    m_has_base = true;
+    m_base_id = id;
+}
+
+bool kdk::resource::has_base() const
+{
+    return m_has_base;
+}
+
+int64_t kdk::resource::base_id() const
+{
+    return m_base_id;
+}
+
+bool kdk::resource::is_linked() const
+{
+    return !m_has_base || m_base;
+}
+
+void kdk::resource::set_base(kdk::arena& arena, const kdk::resource& base)
+{
+    kdk::resource::layer link { base.m_fields, base.m_field_index, base.m_base };
+    m_base = arena.copy(&link, 1).data();
+}
+
+// MARK: - Ranges
+
+void kdk::resource::set_range(kdk::arena& arena, int64_t last, std::string_view name_template)
+{
+    kdk::resource::instance_range range { m_id, last, name_template };
+    m_range = arena.copy(&range, 1).data();
+    m_range_prototype = true;
+}
+
+const kdk::resource::instance_range *kdk::resource::range() const
+{
+    return m_range;
+}
+
+bool kdk::resource::is_range_prototype() const
+{
+    return m_range_prototype;
+}
+
+std::vector<kdk::resource> kdk::resource::expand_range() const
+{
+    std::vector<kdk::resource> instances;
+    instances.reserve(static_cast<std::size_t>(m_range->last - m_range->first + 1));
+    
+    for (auto id = m_range->first; id <= m_range->last; ++id) {
+        // Substitute the id in to the name, which is the only part of each instance that
+        // is not shared.
+        std::string name;
+        auto number = std::to_string(id);
+        for (std::size_t n = 0; n < m_range->name.size(); ) {
+            if (m_range->name.compare(n, 3, "{n}") == 0) {
+                name.append(number);
+                n += 3;
+            }
+            else {
+                name.push_back(m_range->name[n++]);
+            }
         }
+        
+        instances.push_back(*this);
+        instances.back().m_id = id;
+        instances.back().m_name = std::move(name);
+        instances.back().m_range_prototype = false;
+    }
+    
+    return instances;
+}
+
+kdk::span<const kdk::resource::field> kdk::resource::fields_named(const kdk::atom name) const
+{
+    auto fields = find_fields(m_fields, m_field_index, name);
+    for (auto layer = m_base; fields.empty() && layer; layer = layer->base) {
+        fields = find_fields(layer->fields, layer->index, name);
+    }
+    return fields;
+}
+
+const kdk::resource::field *kdk::resource::field_named(const kdk::atom name, bool required) const
+{
+    auto fields = fields_named(name);
+    if (!fields.empty()) {
+        return fields.data();
     }
     
     if (required) {
-        throw std::runtime_error("Resource #" + std::to_string(m_id) + " '" + m_type + "' was missing field '" + name + "'");
+        throw std::runtime_error("Resource #" + std::to_string(m_id) + " '" + m_type.str() + "' was missing field '" + name.str() + "'");
     }
     
     return nullptr;
@@ -70,19 +319,131 @@ int64_t kdk::resource::id() const
     return m_id;
 }
 
-std::string kdk::resource::name() const
+const std::string& kdk::resource::name() const
 {
     return m_name;
 }
 
-std::string kdk::resource::type() const
+kdk::atom kdk::resource::type() const
 {
     return m_type;
 }
 
+kdl::source_manager::file_id kdk::resource::source_file() const
+{
+    return m_source_file;
+}
+
+std::string_view kdk::resource::source_text() const
+{
+    return m_source_text;
+}
+
+uint32_t kdk::resource::source_offset() const
+{
+    return source_offset(m_source_text);
+}
+
+uint32_t kdk::resource::source_offset(std::string_view text) const
+{
+    if (m_source_file == kdl::source_manager::invalid_file) {
+        return 0;
+    }
+    return static_cast<uint32_t>(text.data() - kdl::source_manager::shared().contents(m_source_file).data());
+}
+
 // MARK: - Mutators
 
-void kdk::resource::add_field(const kdk::resource::field& field)
+void kdk::resource::set_source(kdl::source_manager::file_id file, std::string_view text)
 {
-    m_fields.push_back(field);
+    m_source_file = file;
+    m_source_text = text;
+}
+
+void kdk::resource::set_fields(kdk::arena& arena, kdk::span<kdk::resource::field> fields)
+{
+    m_fields = fields;
+    m_field_index = {};
+    if (fields.empty()) {
+        return;
+    }
+    
+    // The index is an open addressed hash table, kept at most half full so that probes
+    // stay short.
+    std::size_t capacity = 2;
+    while (capacity < fields.size() * 2) {
+        capacity <<= 1;
+    }
+    auto mask = capacity - 1;
+    std::vector<kdk::resource::field_slot> index(capacity, { kdk::atom(), 0, 0 });
+    
+    // Count the occurrences of each name, noting the order in which the names first appear.
+    std::vector<std::size_t> groups;
+    for (const auto& field : fields) {
+        auto n = std::hash<kdk::atom>()(field.name()) & mask;
+        while (index[n].count > 0 && index[n].name != field.name()) {
+            n = (n + 1) & mask;
+        }
+        if (index[n].count++ == 0) {
+            index[n].name = field.name();
+            groups.push_back(n);
+        }
+    }
+    
+    uint32_t first = 0;
+    for (auto n : groups) {
+        index[n].first = first;
+        first += index[n].count;
+    }
+    
+    // Fields given more than once are moved next to their first occurrence, so that each
+    // name refers to a single run of fields.
+    if (groups.size() < fields.size()) {
+        std::vector<kdk::resource::field> given(fields.begin(), fields.end());
+        std::vector<uint32_t> placed(capacity, 0);
+        for (const auto& field : given) {
+            auto n = std::hash<kdk::atom>()(field.name()) & mask;
+            while (index[n].name != field.name()) {
+                n = (n + 1) & mask;
+            }
+            fields[index[n].first + placed[n]++] = field;
+        }
+    }
+    
+    m_field_index = arena.copy(index.data(), index.size());
+}
+
+void kdk::resource::set_fields(kdk::arena& arena, const std::vector<std::tuple<kdk::atom, std::string_view, std::size_t>>& fields, const std::vector<kdk::resource::field::value>& values)
+{
+    // The values of all fields are stored as a single run, and each field refers to its own
+    // part of that run.
+    auto run = arena.copy(values.data(), values.size());
+    auto storage = static_cast<kdk::resource::field *>(arena.allocate(sizeof(kdk::resource::field) * fields.size(), alignof(kdk::resource::field)));
+    
+    std::size_t first = 0;
+    for (std::size_t n = 0; n < fields.size(); ++n) {
+        auto count = std::get<2>(fields[n]);
+        new (storage + n) kdk::resource::field(std::get<0>(fields[n]), m_source_file, std::get<1>(fields[n]), kdk::span<kdk::resource::field::value>(run.data() + first, count));
+        first += count;
+    }
+    
+    set_fields(arena, kdk::span<kdk::resource::field>(storage, fields.size()));
+}
+
+void kdk::resource::relocate_text(const char *begin, const char *end, const char *destination)
+{
+    relocate(m_source_text, begin, end, destination);
+    
+    // Everything else may be shared with the other resources of a range, and must only be
+    // relocated once.
+    if (m_range && m_id != m_range->first) {
+        return;
+    }
+    if (m_range) {
+        relocate(m_range->name, begin, end, destination);
+    }
+    
+    for (auto& field : m_fields) {
+        field.relocate_text(begin, end, destination);
+    }
 }
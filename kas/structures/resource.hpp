@@ -21,9 +21,15 @@
 */
 
 #include <string>
+#include <string_view>
 #include <vector>
-#include <tuple>
 #include <memory>
+#include <cstdint>
+#include <utility>
+#include <tuple>
+#include "structures/arena.hpp"
+#include "structures/atom.hpp"
+#include "kdl/source_manager.hpp"
 
 #if !defined(KDK_RESOURCE)
 #define KDK_RESOURCE
@@ -43,7 +49,7 @@ public:
     
     /**
      * The resource field denotes a key-value pair of sorts. Fields can represent
-     * a few different types of value, which are stored as textual values along with
+     * a few different types of value, which are stored as decoded values along with
      * a value type.
      */
     struct field
@@ -53,7 +59,7 @@ public:
         /**
          * The type of a value encoded in the field.
          */
-        enum value_type
+        enum value_type : uint8_t
         {
             identifier,
             resource_id,
@@ -62,27 +68,127 @@ public:
             percentage,
             file_reference,
             color,
+            expression,
+        };
+        
+        /**
+         * A single decoded value of a field. Numeric values (integers, percentages,
+         * resource ids and colors) are held directly, and textual values (strings,
+         * identifiers, file references and expressions) refer to the source text that
+         * they were parsed from, which is owned by the `kdl::source_manager`.
+         *
+         * An expression value is an arithmetic expression that refers to named constants,
+         * and so could not be folded when it was parsed. It is replaced by the value that
+         * it folds to once every constant is known.
+         */
+        class value
+        {
+        public:
+            /**
+             * Construct a new numeric value.
+             */
+            value(value_type type, int64_t number);
+            
+            /**
+             * Construct a new textual value.
+             */
+            value(value_type type, std::string_view text);
+            
+            /**
+             * Construct a new identifier value, along with the interned identifier.
+             */
+            value(std::string_view text, kdk::atom atom);
+            
+            /**
+             * Returns the type of the value.
+             */
+            value_type type() const;
+            
+            /**
+             * Returns the number held by an integer, percentage or resource id value.
+             */
+            int64_t number() const;
+            
+            /**
+             * Returns the packed 0x00RRGGBB color held by a color value.
+             */
+            uint32_t color() const;
+            
+            /**
+             * Returns the text held by a string, identifier, file reference or expression
+             * value.
+             */
+            std::string_view text() const;
+            
+            /**
+             * Returns the interned text of an identifier value.
+             */
+            kdk::atom atom() const;
+            
+            /**
+             * If the value refers to source text in the range [begin, end), move it to
+             * refer to the same text at destination instead. This is used when the
+             * source buffer that the text lives in has been edited.
+             */
+            void relocate_text(const char *begin, const char *end, const char *destination);
+            
+        private:
+            int64_t m_number { 0 };
+            std::string_view m_text;
+            value_type m_type;
         };
         
     public:
         /**
-         * Construct a new resource field with the specified name, values and encodings.
+         * Construct a new resource field with the specified name and values. The source
+         * text is the name as it appears in the source buffer, and the values are expected
+         * to live in an arena that outlives the field.
          */
-        field(const std::string name, std::vector<std::tuple<std::string, value_type>> values);
+        field(kdk::atom name, kdl::source_manager::file_id file, std::string_view source_text, kdk::span<value> values);
         
         /**
          * Returns the name of the field
          */
-        std::string name() const;
+        kdk::atom name() const;
+        
+        /**
+         * Returns the name of the field as it appears in the source.
+         */
+        std::string_view source_text() const;
+        
+        /**
+         * Returns the source buffer that the field was given in. This is not necessarily
+         * the source buffer of the resource, as a field may be inherited from a base
+         * resource defined elsewhere.
+         */
+        kdl::source_manager::file_id source_file() const;
         
         /**
-         * Returns the vector containing the values.
+         * Returns the byte offset in the source buffer at which the field was given.
          */
-        std::vector<std::tuple<std::string, resource::field::value_type>> values() const;
+        uint32_t source_offset() const;
+        
+        /**
+         * Returns the values of the field.
+         */
+        kdk::span<const value> values() const;
+        
+        /**
+         * Returns the values of the field, so that they can be replaced in place.
+         */
+        kdk::span<value> values();
+        
+        /**
+         * Relocate the source text of the name and each of the values. See
+         * `value::relocate_text`.
+         */
+        void relocate_text(const char *begin, const char *end, const char *destination);
         
     private:
-        std::string m_name;
-        std::vector<std::tuple<std::string, value_type>> m_values;
+        kdk::atom m_name;
+        kdl::source_manager::file_id m_file { kdl::source_manager::invalid_file };
+        std::string_view m_source_text;
+        kdk::span<value> m_values;
     };
     
     
@@ -90,12 +196,49 @@ public:
     /**
      * Construct a new target with the specified output path.
      */
-    resource(const std::string type, const int64_t id, const std::string name);
+    resource(const kdk::atom type, const int64_t id, const std::string name);
+    
+    /**
+     * A slot in the hash index of the fields of a resource, giving the run of fields that
+     * share a name. An empty slot has a count of zero. The index lives in an arena, and is
+     * shared by every copy of the resource.
+     */
+    struct field_slot
+    {
+        kdk::atom name;
+        uint32_t first;
+        uint32_t count;
+    };
+    
+    /**
+     * The fields that a resource inherits from its base resource. A base resource may
+     * itself have a base, so the layers form a chain that is searched in order. Layers
+     * live in an arena, and only refer to the fields of the base and their index, which
+     * are never copied.
+     */
+    struct layer
+    {
+        kdk::span<resource::field> fields;
+        kdk::span<resource::field_slot> index;
+        const layer *base;
+    };
+    
+    /**
+     * A run of resources with consecutive ids, all defined by a single body. Every resource
+     * in the run shares the fields of the body, along with the range itself, which lives in
+     * an arena.
+     */
+    struct instance_range
+    {
+        int64_t first;
+        int64_t last;
+        std::string_view name;
+    };
     
     /**
      * Returns the resource structure type.
      */
-    std::string type() const;
+    kdk::atom type() const;
     
     /**
      * Returns the id of the resource
@@ -105,23 +248,175 @@ public:
     /**
      * Returns the name of the resource
      */
-    std::string name() const;
+    const std::string& name() const;
+    
+    /**
+     * Set the source location of the resource, given as the source text of the token that
+     * introduced it. The location refers to the text rather than to an offset, so that it
+     * follows the text whenever it is relocated.
+     */
+    void set_source(kdl::source_manager::file_id file, std::string_view text);
+    
+    /**
+     * Returns the source buffer that the resource was defined in.
+     */
+    kdl::source_manager::file_id source_file() const;
+    
+    /**
+     * Returns the source text of the token that introduced the resource.
+     */
+    std::string_view source_text() const;
+    
+    /**
+     * Returns the byte offset in the source buffer at which the resource was defined.
+     */
+    uint32_t source_offset() const;
+    
+    /**
+     * Returns the byte offset in the source buffer of the specified text of the resource,
+     * such as the name of one of its fields.
+     */
+    uint32_t source_offset(std::string_view text) const;
+    
+    /**
+     * Set the fields of the resource. The fields are not copied, and are expected to live
+     * in an arena that outlives the resource, along with their values. Copies of the
+     * resource share the same fields. The fields are indexed by name, and the index is
+     * allocated in the specified arena.
+     */
+    void set_fields(kdk::arena& arena, kdk::span<resource::field> fields);
+    
+    /**
+     * Copy fields in to the specified arena as a single contiguous run, and set them as
+     * the fields of the resource. Each field is given as a name, the source text of the
+     * name and a number of values, which are taken in turn from the run of values. The
+     * fields are taken to be in the source buffer of the resource, so the source of the
+     * resource should be set first.
+     */
+    void set_fields(kdk::arena& arena, const std::vector<std::tuple<kdk::atom, std::string_view, std::size_t>>& fields, const std::vector<resource::field::value>& values);
+    
+    /**
+     * Returns the fields given in the definition of the resource itself, in the order that
+     * they were given, except that a field given more than once is kept together with its
+     * first occurrence. Fields inherited from a base resource are not included.
+     */
+    kdk::span<const resource::field> fields() const;
+    
+    /**
+     * Returns the fields given in the definition of the resource itself, so that they can
+     * be updated in place. The fields are shared with every copy of the resource.
+     */
+    kdk::span<resource::field> fields();
+    
+    /**
+     * Set the id of the base resource, of the same type, that this resource inherits any
+     * fields it does not give itself from. The base is linked later, through `set_base`,
+     * once every resource is known.
+     */
+    void set_base_id(int64_t id);
+    
+    /**
+     * Test if the resource has a base resource.
+     */
+    bool has_base() const;
+    
+    /**
+     * Returns the id of the base resource.
+     */
+    int64_t base_id() const;
+    
+    /**
+     * Test if the base resource has been linked through `set_base`. Resources that have no
+     * base are always linked.
+     */
+    bool is_linked() const;
+    
+    /**
+     * Link the fields of the base resource, which must itself already be linked, so that
+     * they are inherited by this resource. The fields are shared with the base rather than
+     * copied. The link is allocated in the specified arena.
+     */
+    void set_base(kdk::arena& arena, const kdk::resource& base);
+    
+    /**
+     * Set the variants of the target that the resource is included in. The variants are not
+     * copied, and are expected to live in an arena that outlives the resource.
+     */
+    void set_variants(kdk::span<kdk::atom> variants);
+    
+    /**
+     * Returns the variants that the resource is included in. A resource that does not name
+     * any variants is included in every variant.
+     */
+    kdk::span<const kdk::atom> variants() const;
+    
+    /**
+     * Test if the resource is included in the specified variant. An empty variant is the
+     * plain build of a target, which only includes the resources that do not name any
+     * variants.
+     */
+    bool in_variant(const kdk::atom variant) const;
+    
+    /**
+     * Make the resource the prototype of a range of resources, with ids from its own id up
+     * to and including the specified id. Each resource in the range is named after the
+     * specified template, in which `{n}` is replaced with the id of the resource. The range
+     * is allocated in the specified arena.
+     */
+    void set_range(kdk::arena& arena, int64_t last, std::string_view name_template);
+    
+    /**
+     * Returns the range that the resource belongs to, or nullptr if it does not belong to
+     * a range.
+     */
+    const instance_range *range() const;
+    
+    /**
+     * Test if the resource is the prototype of a range, rather than one of the resources in
+     * it. A prototype stands in for the whole range until it is added to a target.
+     */
+    bool is_range_prototype() const;
+    
+    /**
+     * Returns each of the resources in the range of a prototype. The resources share the
+     * fields, variants and base of the prototype, so only their ids and names are their own.
+     */
+    std::vector<kdk::resource> expand_range() const;
+    
+    /**
+     * Returns every occurrence of the field with the specified name, in the order that they
+     * were given. Fields that the resource does not give itself are looked up in its base
+     * resource. The fields are owned by the arena of the resource, and are not copied.
+     */
+    kdk::span<const resource::field> fields_named(const kdk::atom name) const;
     
     /**
-     * Add a new field to the end of the resource.
+     * Returns the first occurrence of the field with the specified name, or nullptr if the
+     * resource does not have the field. See `fields_named`.
      */
-    void add_field(const resource::field& field);
+    const resource::field *field_named(const kdk::atom name, bool required = false) const;
     
     /**
-     * Returns the field with the specified name.
+     * Relocate the source text of each of the field values. See `field::value::relocate_text`.
+     * The fields shared by a range of resources are relocated along with the first resource
+     * of the range.
      */
-    std::shared_ptr<resource::field> field_named(const std::string name, bool required = false) const;
+    void relocate_text(const char *begin, const char *end, const char *destination);
     
 private:
     int64_t m_id { 0 };
-    std::string m_type { "" };
+    kdk::atom m_type;
     std::string m_name { "" };
-    std::vector<resource::field> m_fields;
+    kdk::span<resource::field> m_fields;
+    kdk::span<resource::field_slot> m_field_index;
+    kdk::span<kdk::atom> m_variants;
+    bool m_has_base { false };
+    int64_t m_base_id { 0 };
+    const layer *m_base { nullptr };
+    instance_range *m_range { nullptr };
+    bool m_range_prototype { false };
+    kdl::source_manager::file_id m_source_file { kdl::source_manager::invalid_file };
+    std::string_view m_source_text;
 };
 
 };
@@ -20,49 +20,511 @@
 * SOFTWARE.
 */
 
+#include <algorithm>
+#include <thread>
 #include "structures/target.hpp"
 #include "rsrc/file.hpp"
+#include "diagnostic/log.hpp"
 #include "assemblers/assembler.hpp"
-#include "assemblers/sprite_animation.hpp"
-#include "assemblers/asteroid.hpp"
+#include "assemblers/assembler_registry.hpp"
+
+// MARK: - Helpers
+
+namespace
+{
+
+/**
+ * Test if there is any variant that includes both of the specified resources.
+ */
+bool share_variant(const kdk::resource& lhs, const kdk::resource& rhs)
+{
+    if (lhs.variants().empty() || rhs.variants().empty()) {
+        return true;
+    }
+    for (auto variant : lhs.variants()) {
+        if (rhs.in_variant(variant)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Remove the entry for the specified position from an index.
+ */
+template<typename Index, typename Key>
+void erase_position(Index& index, const Key& key, std::size_t position)
+{
+    auto range = index.equal_range(key);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == position) {
+            index.erase(it);
+            return;
+        }
+    }
+}
+
+};
 
 // MARK: - Constructor
 
 kdk::target::target(std::string path)
-    : m_path(path)
+    : m_path(path), m_arena(std::make_shared<kdk::arena>())
 {
     
 }
 
+kdk::target::target(std::string path, std::shared_ptr<kdk::arena> arena)
+    : m_path(path), m_arena(arena)
+{
+    
+}
+
+// MARK: - Accessors
+
+kdk::arena& kdk::target::arena()
+{
+    return *m_arena;
+}
+
+void kdk::target::retain(std::shared_ptr<kdk::arena> arena)
+{
+    m_retained_arenas.push_back(arena);
+}
+
 // MARK: - Resource Management
 
-void kdk::target::add_resources(const std::vector<kdk::resource> resources)
+void kdk::target::add_resources(std::vector<kdk::resource> resources)
+{
+    std::lock_guard<std::mutex> lock(*m_index_lock);
+    std::vector<kdk::target::clash> clashes;
+    for (auto& resource : resources) {
+        if (resource.is_range_prototype()) {
+            for (auto& instance : resource.expand_range()) {
+                m_resources.push_back(std::move(instance));
+                index_resource(m_resources.size() - 1, clashes);
+            }
+            continue;
+        }
+        m_resources.push_back(std::move(resource));
+        index_resource(m_resources.size() - 1, clashes);
+    }
+    report_clashes(clashes);
+}
+
+void kdk::target::merge(kdk::target&& other)
+{
+    add_resources(std::move(other.m_resources));
+    other.m_resources.clear();
+    other.m_ids.clear();
+    other.m_names.clear();
+    retain(other.m_arena);
+    for (const auto& arena : other.m_retained_arenas) {
+        retain(arena);
+    }
+    for (auto variant : other.m_variants) {
+        declare_variant(variant);
+    }
+    for (const auto& constant : other.m_constants) {
+        define_constant(constant);
+    }
+}
+
+// MARK: - Variants
+
+void kdk::target::declare_variant(const kdk::atom name)
+{
+    if (std::find(std::begin(m_variants), std::end(m_variants), name) == std::end(m_variants)) {
+        m_variants.push_back(name);
+    }
+}
+
+const std::vector<kdk::atom>& kdk::target::variants() const
+{
+    return m_variants;
+}
+
+// MARK: - Constants
+
+void kdk::target::define_constant(const kdk::target::constant& constant)
+{
+    if (!m_constant_names.emplace(constant.name, m_constants.size()).second) {
+        log::error(constant.file, constant.offset, "The constant '" + constant.name.str() + "' has already been defined.");
+    }
+    m_constants.push_back(constant);
+}
+
+const std::vector<kdk::target::constant>& kdk::target::constants() const
+{
+    return m_constants;
+}
+
+void kdk::target::clear_definitions()
+{
+    m_variants.clear();
+    m_constants.clear();
+    m_constant_names.clear();
+}
+
+void kdk::target::replace_resources(std::size_t first, std::size_t count, std::vector<kdk::resource> resources)
+{
+    std::lock_guard<std::mutex> lock(*m_index_lock);
+    
+    for (auto n = first; n < first + count; ++n) {
+        unindex_resource(n);
+    }
+    
+    // The resources following those being replaced are moving, so their positions in the
+    // indices need to follow them.
+    if (count != resources.size()) {
+        auto shift = [&] (auto& index) {
+            for (auto& entry : index) {
+                if (entry.second >= first + count) {
+                    entry.second = entry.second - count + resources.size();
+                }
+            }
+        };
+        shift(m_ids);
+        shift(m_names);
+    }
+    
+    // Overwrite the resources in place where possible, so that the resources following them
+    // only need to be shuffled along if the number of resources has changed.
+    auto common = std::min(count, resources.size());
+    std::move(std::begin(resources), std::begin(resources) + common, std::begin(m_resources) + first);
+    
+    auto end = std::begin(m_resources) + first + common;
+    if (count > common) {
+        m_resources.erase(end, end + (count - common));
+    }
+    else {
+        m_resources.insert(end, std::make_move_iterator(std::begin(resources) + common), std::make_move_iterator(std::end(resources)));
+    }
+    
+    std::vector<kdk::target::clash> clashes;
+    for (auto n = first; n < first + resources.size(); ++n) {
+        index_resource(n, clashes);
+    }
+    report_clashes(clashes);
+}
+
+const std::vector<kdk::resource>& kdk::target::resources() const
+{
+    return m_resources;
+}
+
+std::vector<kdk::resource> kdk::target::take_resources()
+{
+    std::lock_guard<std::mutex> lock(*m_index_lock);
+    m_ids.clear();
+    m_names.clear();
+    auto resources = std::move(m_resources);
+    m_resources.clear();
+    return resources;
+}
+
+void kdk::target::index_resource(std::size_t position, std::vector<kdk::target::clash>& clashes)
+{
+    const auto& resource = m_resources[position];
+    
+    // Resources may only share an id or a name if no variant includes both of them.
+    auto clashes_with = [&] (const auto& index, const auto& key) {
+        auto range = index.equal_range(key);
+        return std::any_of(range.first, range.second, [&] (const auto& entry) {
+            return share_variant(resource, m_resources[entry.second]);
+        });
+    };
+    
+    auto id_key = std::make_pair(resource.type(), resource.id());
+    if (clashes_with(m_ids, id_key)) {
+        clashes.push_back({ position, "Resource #" + std::to_string(resource.id()) + " of type '" + resource.type().str() + "' has already been defined." });
+    }
+    m_ids.emplace(id_key, position);
+    
+    // Resources do not need to be named, but any names that are given must be unique.
+    if (!resource.name().empty()) {
+        auto name_key = std::make_pair(resource.type(), resource.name());
+        if (clashes_with(m_names, name_key)) {
+            clashes.push_back({ position, "A resource of type '" + resource.type().str() + "' named '" + resource.name() + "' has already been defined." });
+        }
+        m_names.emplace(name_key, position);
+    }
+}
+
+void kdk::target::report_clashes(const std::vector<kdk::target::clash>& clashes) const
+{
+    for (std::size_t n = 0; n < clashes.size(); ++n) {
+        const auto& resource = m_resources[clashes[n].position];
+        log::error(resource.source_file(), resource.source_offset(), clashes[n].message, n + 1 == clashes.size());
+    }
+}
+
+void kdk::target::unindex_resource(std::size_t position)
 {
-    m_resources.insert(std::end(m_resources), std::begin(resources), std::end(resources));
+    const auto& resource = m_resources[position];
+    erase_position(m_ids, std::make_pair(resource.type(), resource.id()), position);
+    if (!resource.name().empty()) {
+        erase_position(m_names, std::make_pair(resource.type(), resource.name()), position);
+    }
+}
+
+// MARK: - Base Resources
+
+void kdk::target::link_bases()
+{
+    std::lock_guard<std::mutex> lock(*m_index_lock);
+    
+    // Find the base of a resource. Where resources in different variants share an id, the
+    // base must be the only one of them that shares a variant with the resource.
+    auto base_of = [this] (std::size_t position) {
+        const auto& resource = m_resources[position];
+        auto range = m_ids.equal_range(std::make_pair(resource.type(), resource.base_id()));
+        auto base = m_resources.size();
+        
+        for (auto it = range.first; it != range.second; ++it) {
+            if (!share_variant(resource, m_resources[it->second])) {
+                continue;
+            }
+            if (base != m_resources.size()) {
+                log::error(resource.source_file(), resource.source_offset(), "The base resource #" + std::to_string(resource.base_id()) + " of type '" + resource.type().str() + "' differs between variants.");
+            }
+            base = it->second;
+        }
+        
+        if (base == m_resources.size()) {
+            log::error(resource.source_file(), resource.source_offset(), "The base resource #" + std::to_string(resource.base_id()) + " of type '" + resource.type().str() + "' does not exist.");
+        }
+        return base;
+    };
+    
+    // Follow the chain of bases up to a resource that is already linked, and then link the
+    // chain from the top down, as each resource can only be linked once its base has been.
+    std::vector<bool> in_chain(m_resources.size(), false);
+    std::vector<std::size_t> chain;
+    
+    for (std::size_t n = 0; n < m_resources.size(); ++n) {
+        for (auto position = n; !m_resources[position].is_linked(); position = base_of(position)) {
+            if (in_chain[position]) {
+                const auto& resource = m_resources[position];
+                log::error(resource.source_file(), resource.source_offset(), "The bases of resource #" + std::to_string(resource.id()) + " of type '" + resource.type().str() + "' form a cycle.");
+            }
+            in_chain[position] = true;
+            chain.push_back(position);
+        }
+        
+        while (!chain.empty()) {
+            auto position = chain.back();
+            chain.pop_back();
+            in_chain[position] = false;
+            m_resources[position].set_base(*m_arena, m_resources[base_of(position)]);
+        }
+    }
+}
+
+// MARK: - Field Values
+
+void kdk::target::update_values(const std::function<void(const kdk::resource::field&, kdk::resource::field::value&)>& update)
+{
+    for (auto& resource : m_resources) {
+        // The resources of a range share their fields with the first resource of the range.
+        if (resource.range() && resource.id() != resource.range()->first) {
+            continue;
+        }
+        
+        for (auto& field : resource.fields()) {
+            for (auto& value : field.values()) {
+                update(field, value);
+            }
+        }
+    }
+}
+
+// MARK: - Source Text
+
+void kdk::target::relocate_text(std::size_t first, std::size_t count, const char *begin, const char *end, const char *destination)
+{
+    for (auto n = first; n < first + count; ++n) {
+        m_resources[n].relocate_text(begin, end, destination);
+    }
 }
 
 // MARK: - Build
 
-void kdk::target::build()
+void kdk::target::build(unsigned concurrency)
 {
-    auto rf = rsrc::file::create(m_path);
+    build({ { kdk::atom(), m_path } }, concurrency);
+}
+
+void kdk::target::build(const std::vector<kdk::target::variant>& variants, unsigned concurrency)
+{
+    link_bases();
+    
+    // Every variant that a resource is restricted to must have been declared, so that a
+    // misspelt variant does not silently drop the resource from every build.
+    for (const auto& resource : m_resources) {
+        for (auto variant : resource.variants()) {
+            if (std::find(std::begin(m_variants), std::end(m_variants), variant) == std::end(m_variants)) {
+                log::error(resource.source_file(), resource.source_offset(), "The variant '" + variant.str() + "' has not been declared.");
+            }
+        }
+    }
+    
+    auto included = [&] (const kdk::resource& resource) {
+        return std::any_of(std::begin(variants), std::end(variants), [&] (const kdk::target::variant& variant) {
+            return resource.in_variant(variant.name);
+        });
+    };
+    
+    // Look up the assembler for each resource, and group the resources to be built by type,
+    // in the order that each type is first seen. Every resource must be of a type that can be
+    // assembled, whether or not it is being built.
+    const auto& registry = kdk::assembler_registry::shared();
+    std::vector<std::pair<const kdk::assembler_registry::entry *, std::vector<std::size_t>>> batches;
+    std::unordered_map<const kdk::assembler_registry::entry *, std::size_t> batch_index;
+    
+    for (std::size_t n = 0; n < m_resources.size(); ++n) {
+        const auto& resource = m_resources[n];
+        auto entry = registry.find(resource.type());
+        if (!entry) {
+            log::error(resource.source_file(), resource.source_offset(), "There is no assembler for resources of type '" + resource.type().str() + "'.");
+        }
+        
+        if (!included(resource)) {
+            continue;
+        }
+        
+        auto batch = batch_index.emplace(entry, batches.size());
+        if (batch.second) {
+            batches.emplace_back(entry, std::vector<std::size_t>());
+        }
+        batches[batch.first->second].second.push_back(n);
+    }
     
-    // Iterate through each of the resources and construct the data for each of them.
-    // Currently this is done by manually testing the type and invoking the appropriate
-    // type assembler. This could be improved by making KDL more extensible.
-    for (auto resource : m_resources) {
-        auto type = resource.type();
+    // The assembled data is shared by every variant that includes the resource, and by
+    // every resource of a range.
+    struct product
+    {
+        const kdk::assembler_registry::entry *entry { nullptr };
+        std::shared_ptr<const rsrc::data> data;
+        std::vector<kdk::assembler::reference> references;
+    };
+    std::vector<product> products(m_resources.size());
+    std::unordered_map<const kdk::resource::instance_range *, std::size_t> assembled_ranges;
+    
+    for (const auto& batch : batches) {
+        const auto entry = batch.first;
         
-        if (type == "SpriteAnimation") {
-            kdk::sprite_animation assembler { resource };
-            rf->add_resource("spïn", resource.id(), resource.name(), assembler.assemble());
+        for (auto n : batch.second) {
+            const auto& resource = m_resources[n];
+            
+            // The resources of a range share a single body, and so assemble to the same data.
+            // Only the first of them needs to actually be assembled.
+            if (resource.range()) {
+                auto assembled = assembled_ranges.emplace(resource.range(), n);
+                if (!assembled.second) {
+                    // The references of the range are the same for each resource, and only need
+                    // to be checked once.
+                    products[n] = { entry, products[assembled.first->second].data, {} };
+                    continue;
+                }
+            }
+            
+            products[n].entry = entry;
+            products[n].data = std::make_shared<const rsrc::data>(entry->assemble(resource, products[n].references));
         }
-        else if (type == "Asteroid") {
-            kdk::asteroid assembler { resource };
-            rf->add_resource("röid", resource.id(), resource.name(), assembler.assemble());
+    }
+    
+    // Gather the resources of each variant in to a resource file of its own. Every resource
+    // in the variant is now known, so check that the references between them can all be
+    // resolved before anything is written.
+    std::vector<std::shared_ptr<rsrc::file>> files;
+    for (const auto& variant : variants) {
+        std::vector<kdk::assembler::reference> references;
+        auto rf = rsrc::file::create(variant.path);
+        
+        for (std::size_t n = 0; n < m_resources.size(); ++n) {
+            const auto& resource = m_resources[n];
+            if (!resource.in_variant(variant.name)) {
+                continue;
+            }
+            
+            if (products[n].data) {
+                rf->add_resource(products[n].entry->type_code, resource.id(), resource.name(), products[n].data);
+                references.insert(std::end(references), std::begin(products[n].references), std::end(products[n].references));
+            }
         }
+        
+        validate_references(references, variant.name, concurrency);
+        files.push_back(rf);
     }
     
-    // The resource file should be assembled at this point and just needs writting to disk.
-    rf->write();
+    // The resource files should be assembled at this point and just need writting to disk.
+    for (auto& rf : files) {
+        rf->write();
+    }
+}
+
+// MARK: - Reference Validation
+
+void kdk::target::validate_references(const std::vector<kdk::assembler::reference>& references, const kdk::atom variant, unsigned concurrency) const
+{
+    std::lock_guard<std::mutex> lock(*m_index_lock);
+    
+    if (concurrency == 0) {
+        concurrency = std::max(1U, std::thread::hardware_concurrency());
+    }
+    
+    // Each thread checks a contiguous run of the references, and is only started if it has
+    // at least a minimum number of references to check. Checking only reads the index, so
+    // the runs can be checked alongside each other.
+    constexpr std::size_t minimum_references_per_thread = 4096;
+    auto count = std::max<std::size_t>(1, std::min<std::size_t>(concurrency, references.size() / minimum_references_per_thread));
+    std::vector<std::vector<const kdk::assembler::reference *>> dangling(count);
+    
+    auto check = [this, &references, variant, count, &dangling] (std::size_t n) {
+        auto first = references.size() * n / count;
+        auto last = references.size() * (n + 1) / count;
+        for (auto i = first; i < last; ++i) {
+            // Resources in other variants may share the id, so the reference is only
+            // resolved by a resource in the variant being built.
+            const auto& reference = references[i];
+            auto range = m_ids.equal_range(std::make_pair(reference.type, reference.id));
+            auto found = std::any_of(range.first, range.second, [this, variant] (const auto& entry) {
+                return m_resources[entry.second].in_variant(variant);
+            });
+            if (!found) {
+                dangling[n].push_back(&reference);
+            }
+        }
+    };
+    
+    std::vector<std::thread> workers;
+    for (std::size_t n = 1; n < count; ++n) {
+        workers.emplace_back(check, n);
+    }
+    check(0);
+    
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    
+    // Report the dangling references in source order, stopping after the last of them.
+    std::vector<const kdk::assembler::reference *> reports;
+    for (const auto& missing : dangling) {
+        reports.insert(std::end(reports), std::begin(missing), std::end(missing));
+    }
+    std::stable_sort(std::begin(reports), std::end(reports), [] (auto lhs, auto rhs) {
+        return std::make_pair(lhs->file, lhs->offset) < std::make_pair(rhs->file, rhs->offset);
+    });
+    
+    // A field inherited from a base resource is assembled once for each resource that
+    // inherits it, but only needs to be reported once.
+    reports.erase(std::unique(std::begin(reports), std::end(reports), [] (auto lhs, auto rhs) {
+        return lhs->file == rhs->file && lhs->offset == rhs->offset && lhs->type == rhs->type && lhs->id == rhs->id;
+    }), std::end(reports));
+    
+    for (std::size_t n = 0; n < reports.size(); ++n) {
+        auto reference = reports[n];
+        log::error(reference->file, reference->offset, "The field '" + reference->field.str() + "' refers to resource #" + std::to_string(reference->id) + " of type '" + reference->type.str() + "', which does not exist.", n + 1 == reports.size());
+    }
 }
@@ -22,8 +22,15 @@
 
 #include <string>
 #include <vector>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <unordered_map>
+#include "structures/arena.hpp"
 #include "structures/resource.hpp"
 #include "rsrc/data.hpp"
+#include "assemblers/assembler.hpp"
 
 
 #if !defined(KDK_TARGET)
@@ -42,6 +49,31 @@ namespace kdk
  */
 class target
 {
+public:
+    /**
+     * A variant of the target to be built, such as a demo or debug build, and the path
+     * that it should be written to. Resources declared under an `@if` directive are only
+     * included in the variants that it names.
+     */
+    struct variant
+    {
+        kdk::atom name;
+        std::string path;
+    };
+    
+    /**
+     * A named constant given through the `@define` directive, along with the location of
+     * its name. The value is either already folded, or is an expression that still refers
+     * to other constants.
+     */
+    struct constant
+    {
+        kdk::atom name;
+        kdl::source_manager::file_id file;
+        uint32_t offset;
+        kdk::resource::field::value value;
+    };
+    
 public:
     /**
      * Construct a new target with the specified output path.
@@ -49,9 +81,103 @@ public:
     target(std::string path);
     
     /**
-     * Add resources to the target.
+     * Construct a new target with the specified output path, whose resources are
+     * allocated in the specified arena.
+     */
+    target(std::string path, std::shared_ptr<kdk::arena> arena);
+    
+    /**
+     * Returns the arena that the parsed model of the target is allocated in. Everything
+     * in the arena is released together once the arena is no longer referenced.
+     */
+    kdk::arena& arena();
+    
+    /**
+     * Keep the specified arena alive for as long as the target. This is needed when
+     * resources that were parsed in to another arena are added to the target.
+     */
+    void retain(std::shared_ptr<kdk::arena> arena);
+    
+    /**
+     * Add resources to the target. Each resource is entered in to the indices of the
+     * target as it arrives, and a resource that has the same type and id, or the same
+     * type and name, as one already in the target is reported as an error. The prototype
+     * of a range of resources is replaced by the resources of the range. The resources are
+     * moved in to the target, so callers should move them in rather than copy them.
+     */
+    void add_resources(std::vector<kdk::resource> resources);
+    
+    /**
+     * Move all of the resources of another target to the end of this target, keeping alive
+     * the arenas that they were parsed in to.
+     */
+    void merge(kdk::target&& other);
+    
+    /**
+     * Declare a variant that resources of the target may be included in.
+     */
+    void declare_variant(const kdk::atom name);
+    
+    /**
+     * Returns the variants that have been declared, in the order that they were declared.
+     */
+    const std::vector<kdk::atom>& variants() const;
+    
+    /**
+     * Define a named constant. A constant that has the same name as one already in the
+     * target is reported as an error.
+     */
+    void define_constant(const kdk::target::constant& constant);
+    
+    /**
+     * Returns the constants that have been defined, in the order that they were defined.
+     */
+    const std::vector<kdk::target::constant>& constants() const;
+    
+    /**
+     * Remove every variant and constant from the target, so that they can be declared
+     * again from scratch.
+     */
+    void clear_definitions();
+    
+    /**
+     * Replace a run of resources in the target with a new set of resources, preserving
+     * the order of all other resources. This allows a part of the target to be rebuilt
+     * without disturbing the rest.
+     */
+    void replace_resources(std::size_t first, std::size_t count, std::vector<kdk::resource> resources);
+    
+    /**
+     * Returns the resources that have been added to the target.
+     */
+    const std::vector<kdk::resource>& resources() const;
+    
+    /**
+     * Move all of the resources out of the target, leaving it empty. The arenas of the
+     * target must be kept alive for as long as the resources are.
+     */
+    std::vector<kdk::resource> take_resources();
+    
+    /**
+     * Link each resource that names a base resource to the fields of that base. This is
+     * only done once every resource is known, so a base may be defined anywhere in the
+     * target, including in another file. Missing, ambiguous and cyclic bases are reported
+     * as errors. Building the target links the resources first.
+     */
+    void link_bases();
+    
+    /**
+     * Call the specified function with each value of each field given by the resources of
+     * the target, allowing the value to be replaced. The fields shared by a range of
+     * resources are only visited once.
      */
-    void add_resources(const std::vector<kdk::resource> resources);
+    void update_values(const std::function<void(const kdk::resource::field&, kdk::resource::field::value&)>& update);
+    
+    /**
+     * Relocate the source text referenced by a run of resources in the target. See
+     * `kdk::resource::field::value::relocate_text`.
+     */
+    void relocate_text(std::size_t first, std::size_t count, const char *begin, const char *end, const char *destination);
     
     /**
      * Build the kestrel data file.
@@ -59,13 +185,89 @@ public:
      * This method will begin the process of validating all of the resources added
      * to the target, converting them into data objects and assembling the resource
      * file.
+     *
+     * Only the resources that are not restricted to particular variants are included.
+     *
+     * \param concurrency The number of threads that may be used to check the references
+     *                    between resources. Passing 0 will use the number of hardware threads.
+     */
+    void build(unsigned concurrency = 1);
+    
+    /**
+     * Build a kestrel data file for each of the specified variants of the target.
+     *
+     * Each resource is assembled only once, however many of the variants include it, and
+     * the assembled data is shared between all of those variants. A variant with an empty
+     * name is the plain build of the target.
+     *
+     * \param concurrency The number of threads that may be used to check the references
+     *                    between resources. Passing 0 will use the number of hardware threads.
+     */
+    void build(const std::vector<kdk::target::variant>& variants, unsigned concurrency = 1);
+    
+private:
+    /**
+     * Hashes the (type, id) and (type, name) keys of the resource indices.
+     */
+    struct key_hash
+    {
+        template<typename T>
+        std::size_t operator()(const std::pair<kdk::atom, T>& key) const
+        {
+            auto seed = std::hash<kdk::atom>()(key.first);
+            return seed ^ (std::hash<T>()(key.second) + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+        }
+    };
+    
+    /**
+     * A resource that duplicates the id or name of another resource, to be reported once
+     * the indices are consistent again.
+     */
+    struct clash
+    {
+        std::size_t position;
+        std::string message;
+    };
+    
+    /**
+     * Enter the resource at the specified position in to the indices. If it is a duplicate
+     * of a resource that is already present in any of the same variants, then it is still
+     * entered, and the clash is added to the specified list. The index lock must be held.
+     */
+    void index_resource(std::size_t position, std::vector<kdk::target::clash>& clashes);
+    
+    /**
+     * Report each of the clashes found whilst indexing resources. The indices are complete
+     * by this point, so reporting can safely unwind when errors are being captured.
+     */
+    void report_clashes(const std::vector<kdk::target::clash>& clashes) const;
+    
+    /**
+     * Remove the resource at the specified position from the indices. The index lock must
+     * be held.
+     */
+    void unindex_resource(std::size_t position);
+    
+    /**
+     * Check that every reference made between resources refers to a resource that exists
+     * in the specified variant of the target, reporting each one that does not. Checking
+     * a reference is a single lookup in the index, so the references are only split
+     * between threads when there are enough of them to pay for the threads.
      */
-    void build();
+    void validate_references(const std::vector<kdk::assembler::reference>& references, const kdk::atom variant, unsigned concurrency) const;
     
 private:
     rsrc::data m_data;
     std::string m_path;
     std::vector<kdk::resource> m_resources;
+    std::unordered_multimap<std::pair<kdk::atom, int64_t>, std::size_t, key_hash> m_ids;
+    std::unordered_multimap<std::pair<kdk::atom, std::string>, std::size_t, key_hash> m_names;
+    std::unique_ptr<std::mutex> m_index_lock { std::make_unique<std::mutex>() };
+    std::shared_ptr<kdk::arena> m_arena;
+    std::vector<std::shared_ptr<kdk::arena>> m_retained_arenas;
+    std::vector<kdk::atom> m_variants;
+    std::vector<kdk::target::constant> m_constants;
+    std::unordered_map<kdk::atom, std::size_t> m_constant_names;
 };
 
 };
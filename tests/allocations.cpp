@@ -0,0 +1,134 @@
+/*
+* Copyright (c) 2019 Tom Hancocks
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include "kdl/importer.hpp"
+#include "structures/target.hpp"
+
+// Count the heap allocations made for each resource by a full compile of a generated
+// source, and check them against an upper bound, so that copies reintroduced between the
+// stages of the compile are caught.
+
+// MARK: - Allocation Counting
+
+namespace
+{
+
+std::atomic<long> allocations { 0 };
+
+};
+
+void *operator new(std::size_t size)
+{
+    allocations++;
+    if (auto ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+// MARK: - Helpers
+
+namespace
+{
+
+/**
+ * The upper bounds on the number of allocations made for each resource. Parsing currently
+ * makes 9 allocations per resource, and parsing and building together make 31.
+ */
+constexpr double parse_bound = 12;
+constexpr double build_bound = 36;
+
+/**
+ * Compile a generated source of the specified number of resources, optionally building
+ * it, and return the number of allocations that were made.
+ */
+long compile(int count, bool build)
+{
+    std::string source = "declare Asteroid {\n";
+    for (int n = 0; n < count; ++n) {
+        auto id = std::to_string(1000 + n);
+        source += "    new (id = #" + id + ", name = \"Rock " + id + "\") {\n"
+                  "        strength = 50;\n"
+                  "        yield = #4 20;\n"
+                  "        particles = 4 rgb(200 100 0);\n"
+                  "        fragments = 3 #1000 unused;\n"
+                  "        mass = 75;\n"
+                  "    }\n";
+    }
+    source += "}\n";
+    
+    auto file = kdl::source_manager::shared().add_source("allocations-" + std::to_string(count) + ".kdl", std::move(source));
+    kdk::target target("build/tests/allocations.kdat");
+    
+    auto before = allocations.load();
+    kdl::importer(1, "").run(file, target);
+    if (build) {
+        target.build();
+    }
+    return allocations.load() - before;
+}
+
+/**
+ * Returns the number of allocations made for each resource, ignoring the fixed costs of
+ * the compile by comparing two sizes of source.
+ */
+double allocations_per_resource(bool build)
+{
+    auto small = compile(1000, build);
+    auto large = compile(2000, build);
+    return static_cast<double>(large - small) / 1000;
+}
+
+};
+
+// MARK: - Test
+
+int main(int argc, const char **argv)
+{
+    // Warm up anything that is only allocated once, such as the assembler registry.
+    compile(10, true);
+    
+    auto parse = allocations_per_resource(false);
+    auto build = allocations_per_resource(true);
+    std::cout << "allocations: " << parse << " per resource to parse, " << build << " to parse and build" << std::endl;
+    
+    if (parse > parse_bound || build > build_bound) {
+        std::cerr << "FAIL: allocations exceed the bounds of " << parse_bound << " and " << build_bound << " per resource" << std::endl;
+        return 1;
+    }
+    return 0;
+}
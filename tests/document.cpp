@@ -0,0 +1,299 @@
+/*
+* Copyright (c) 2019 Tom Hancocks
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "kdl/document.hpp"
+#include "kdl/sema.hpp"
+#include "kdl/sema/expression.hpp"
+
+// Apply a long run of pseudo random edits to a document, and check after each of them that
+// the tokens and resources of the document match those of a full parse of the edited source.
+// Edits that introduce errors are checked to be reported without terminating, and are then
+// undone.
+
+// MARK: - Helpers
+
+namespace
+{
+
+int failures = 0;
+
+void check(bool condition, const std::string& message)
+{
+    if (!condition) {
+        std::cerr << "FAIL: " << message << std::endl;
+        failures++;
+    }
+}
+
+/**
+ * A small deterministic generator, so that every run applies the same edits.
+ */
+struct generator
+{
+    uint64_t state { 0x9e3779b97f4a7c15ULL };
+    
+    std::size_t next(std::size_t bound)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return static_cast<std::size_t>(state % bound);
+    }
+};
+
+std::string declaration(int64_t id, int64_t strength)
+{
+    auto n = std::to_string(id);
+    return "declare Asteroid {\n"
+           "    new (id = #" + n + ", name = \"Rock " + n + "\") {\n"
+           "        strength = " + std::to_string(strength) + ";\n"
+           "        mass = BASE + " + std::to_string(id % 7) + ";\n"
+           "        yield = #4 DOUBLE;\n"
+           "        spin_rate = 30%;\n"
+           "        particles = 4 rgb(10 20 30);\n"
+           "        pair = 10 -5;\n"
+           "    }\n"
+           "}\n";
+}
+
+std::string initial_source()
+{
+    std::string source = "` A generated source to edit.\n"
+                         "@variant { demo full }\n"
+                         "@define {\n"
+                         "    BASE = 50;\n"
+                         "    DOUBLE = BASE * 2;\n"
+                         "}\n";
+    for (int64_t id = 128; id < 168; ++id) {
+        source += declaration(id, id * 3);
+    }
+    source += "@if { demo }\n"
+              "declare Asteroid {\n"
+              "    new range(#5000 ... #5009, name = \"Demo {n}\") {\n"
+              "        strength = DOUBLE;\n"
+              "    }\n"
+              "}\n";
+    return source;
+}
+
+/**
+ * Returns the offsets at which each line of the source starts.
+ */
+std::vector<uint32_t> line_starts(std::string_view source)
+{
+    std::vector<uint32_t> starts { 0 };
+    for (uint32_t n = 0; n + 1 < source.size(); ++n) {
+        if (source[n] == '\n') {
+            starts.push_back(n + 1);
+        }
+    }
+    return starts;
+}
+
+/**
+ * Returns the offset and length of every run of digits that follows the specified text.
+ */
+std::vector<std::pair<uint32_t, uint32_t>> numbers_after(std::string_view source, std::string_view prefix)
+{
+    std::vector<std::pair<uint32_t, uint32_t>> numbers;
+    for (auto at = source.find(prefix); at != std::string_view::npos; at = source.find(prefix, at + 1)) {
+        auto begin = at + prefix.size();
+        auto end = begin;
+        while (end < source.size() && source[end] >= '0' && source[end] <= '9') {
+            end++;
+        }
+        if (end > begin) {
+            numbers.emplace_back(static_cast<uint32_t>(begin), static_cast<uint32_t>(end - begin));
+        }
+    }
+    return numbers;
+}
+
+std::string describe(const kdk::resource::field::value& value)
+{
+    return std::to_string(static_cast<int>(value.type())) + ":" + std::to_string(value.number()) + ":" + std::string(value.text());
+}
+
+/**
+ * Compare the document against a full parse of its current source.
+ */
+void compare(kdl::document& document, kdl::source_manager::file_id file, const std::string& context)
+{
+    auto& sources = kdl::source_manager::shared();
+    auto source = sources.contents(file);
+    check(document.diagnostics().empty(), context + ": unexpected diagnostics");
+    
+    auto fresh_file = sources.add_source("fresh.kdl", std::string(source));
+    kdl::lexer lexer(fresh_file);
+    kdl::sema sema(kdk::target(""), lexer);
+    sema.run();
+    auto& expected = sema.target();
+    kdl::expression::fold(expected);
+    
+    // Tokens.
+    auto tokens = document.tokens();
+    kdl::lexer relexer(fresh_file);
+    kdl::lexer::token tk;
+    std::size_t count = 0;
+    while (relexer.next(tk)) {
+        if (count < tokens.size()) {
+            check(tokens[count].offset() == tk.offset() && tokens[count].length() == tk.length() && tokens[count].text() == tk.text(), context + ": token " + std::to_string(count) + " differs");
+        }
+        count++;
+    }
+    check(count == tokens.size(), context + ": token count " + std::to_string(tokens.size()) + " != " + std::to_string(count));
+    
+    // Definitions.
+    const auto& target = document.target();
+    check(target.variants() == expected.variants(), context + ": variants differ");
+    check(target.constants().size() == expected.constants().size(), context + ": constant count differs");
+    for (std::size_t n = 0; n < std::min(target.constants().size(), expected.constants().size()); ++n) {
+        check(target.constants()[n].name == expected.constants()[n].name && target.constants()[n].offset == expected.constants()[n].offset, context + ": constant " + std::to_string(n) + " differs");
+    }
+    
+    // Resources.
+    const auto& resources = target.resources();
+    const auto& expected_resources = expected.resources();
+    check(resources.size() == expected_resources.size(), context + ": resource count " + std::to_string(resources.size()) + " != " + std::to_string(expected_resources.size()));
+    for (std::size_t n = 0; n < std::min(resources.size(), expected_resources.size()); ++n) {
+        const auto& a = resources[n];
+        const auto& b = expected_resources[n];
+        auto name = context + ": resource " + std::to_string(b.id());
+        check(a.type() == b.type() && a.id() == b.id() && a.name() == b.name(), name + " differs");
+        check(a.source_offset() == b.source_offset() && a.source_text() == b.source_text(), name + " has a different source");
+        check(a.variants().size() == b.variants().size(), name + " has different variants");
+        
+        auto fields = a.fields();
+        auto expected_fields = b.fields();
+        check(fields.size() == expected_fields.size(), name + " has a different number of fields");
+        for (std::size_t f = 0; f < std::min(fields.size(), expected_fields.size()); ++f) {
+            check(fields[f].name() == expected_fields[f].name() && fields[f].source_offset() == expected_fields[f].source_offset(), name + " field " + std::to_string(f) + " differs");
+            auto values = fields[f].values();
+            auto expected_values = expected_fields[f].values();
+            check(values.size() == expected_values.size(), name + " field " + std::to_string(f) + " has a different number of values");
+            for (std::size_t v = 0; v < std::min(values.size(), expected_values.size()); ++v) {
+                check(describe(values[v]) == describe(expected_values[v]), name + " field " + std::to_string(f) + " value " + describe(values[v]) + " != " + describe(expected_values[v]));
+            }
+        }
+    }
+}
+
+};
+
+// MARK: - Test
+
+int main(int argc, const char **argv)
+{
+    auto& sources = kdl::source_manager::shared();
+    auto file = sources.add_source("document.kdl", initial_source());
+    kdl::document document(kdk::target(""), file);
+    compare(document, file, "initial");
+    
+    generator random;
+    int64_t next_id = 20000;
+    std::vector<int64_t> inserted;
+    
+    for (int step = 0; step < 400 && failures == 0; ++step) {
+        auto source = std::string(sources.contents(file));
+        auto lines = line_starts(source);
+        auto line = lines[random.next(lines.size())];
+        auto context = "step " + std::to_string(step);
+        
+        switch (random.next(8)) {
+            case 0: {
+                // Change the value of a field.
+                auto numbers = numbers_after(source, "strength = ");
+                auto number = numbers[random.next(numbers.size())];
+                document.edit(number.first, number.second, std::to_string(random.next(100000)));
+                break;
+            }
+            case 1: {
+                // Change the value of a constant, which every block depends on.
+                auto number = numbers_after(source, "BASE = ").front();
+                document.edit(number.first, number.second, std::to_string(random.next(1000)));
+                break;
+            }
+            case 2: {
+                // Insert a comment.
+                document.edit(line, 0, "` note\n");
+                break;
+            }
+            case 3: {
+                // Remove a comment.
+                auto at = source.find("` note\n", random.next(source.size()));
+                if (at != std::string::npos) {
+                    document.edit(static_cast<uint32_t>(at), 7, "");
+                }
+                break;
+            }
+            case 4: {
+                // Insert a declaration between two others.
+                auto at = source.find("\ndeclare", line);
+                at = (at == std::string::npos) ? source.size() : at + 1;
+                inserted.push_back(next_id++);
+                document.edit(static_cast<uint32_t>(at), 0, declaration(inserted.back(), static_cast<int64_t>(random.next(1000))));
+                break;
+            }
+            case 5: {
+                // Remove a declaration that was inserted earlier. It may have been edited since.
+                if (!inserted.empty()) {
+                    auto n = random.next(inserted.size());
+                    auto at = source.rfind("declare", source.find("#" + std::to_string(inserted[n]) + ","));
+                    auto end = source.find("\n}\n", at) + 3;
+                    document.edit(static_cast<uint32_t>(at), static_cast<uint32_t>(end - at), "");
+                    inserted.erase(inserted.begin() + n);
+                }
+                break;
+            }
+            case 6: {
+                // Introduce an error, and then undo it.
+                std::string error = random.next(2) ? "$" : "bogus;\n";
+                document.edit(line, 0, error);
+                check(!document.diagnostics().empty(), context + ": error was not reported");
+                document.edit(line, static_cast<uint32_t>(error.size()), "");
+                break;
+            }
+            case 7: {
+                // Duplicate an existing resource id, and then undo it.
+                auto at = source.find("\ndeclare", line);
+                at = (at == std::string::npos) ? source.size() : at + 1;
+                auto duplicate = declaration(128, 1);
+                document.edit(static_cast<uint32_t>(at), 0, duplicate);
+                check(!document.diagnostics().empty(), context + ": duplicate resource was not reported");
+                document.edit(static_cast<uint32_t>(at), static_cast<uint32_t>(duplicate.size()), "");
+                break;
+            }
+        }
+        
+        compare(document, file, context);
+    }
+    
+    if (failures > 0) {
+        return 1;
+    }
+    std::cout << "document: edits match a full parse" << std::endl;
+    return 0;
+}